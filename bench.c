@@ -0,0 +1,255 @@
+// benchmarks for the mesh builder kernels
+//   runs on a synthetic elevation grid, no .DEM files needed
+//   usage: ./bench [width] [height]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dem.c"
+#include "render.c"
+
+#define REPEAT 10
+
+static double now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// rolling hills with an ocean (no-data) along the left edge, like a coastal tile
+int16_t* syntheticTerrain(unsigned int width, unsigned int height){
+	int16_t *data = (int16_t*)malloc(sizeof(int16_t) * width*height);
+	for(unsigned int h = 0; h < height; h++){
+		float coast = width * (0.3f + 0.1f*sinf(h * 0.01f));
+		for(unsigned int w = 0; w < width; w++){
+			if(w < coast){
+				data[h*width+w] = DEM_NODATA;
+				continue;
+			}
+			float e = 600.0f + 400.0f*sinf(w*0.013f)*cosf(h*0.017f) + 150.0f*sinf(w*0.11f + h*0.07f);
+			data[h*width+w] = (int16_t)e;
+		}
+	}
+	return data;
+}
+
+void report(const char *name, double scalar, double simd){
+	printf("%-12s scalar %8.2f ms   simd+threads %8.2f ms   %5.1fx\n", name, scalar*1000.0, simd*1000.0, scalar/simd);
+}
+
+void benchNormals(int16_t *data, unsigned int width, unsigned int height){
+	float *reference = (float*)malloc(sizeof(float) * width*height*3);
+	float *normals = (float*)malloc(sizeof(float) * width*height*3);
+	double start = now();
+	for(int i = 0; i < REPEAT; i++)
+		elevationNormalsScalar(data, width, height, 1.0f, 1.0f, reference);
+	double scalar = (now() - start) / REPEAT;
+	start = now();
+	for(int i = 0; i < REPEAT; i++)
+		elevationNormals(data, width, height, 1.0f, 1.0f, normals);
+	double simd = (now() - start) / REPEAT;
+	float error = 0.0f;
+	for(unsigned int i = 0; i < width*height*3; i++)
+		if(fabsf(normals[i] - reference[i]) > error) error = fabsf(normals[i] - reference[i]);
+	report("normals", scalar, simd);
+	printf("             max error %g\n", error);
+	free(reference);
+	free(normals);
+}
+
+void benchHillshade(int16_t *data, unsigned int width, unsigned int height){
+	unsigned char *reference = (unsigned char*)malloc(width*height);
+	unsigned char *shade = (unsigned char*)malloc(width*height);
+	double start = now();
+	for(int i = 0; i < REPEAT; i++)
+		hillshadeScalar(data, width, height, 926.0f, 926.0f, 315.0f, 45.0f, reference);
+	double scalar = (now() - start) / REPEAT;
+	start = now();
+	for(int i = 0; i < REPEAT; i++)
+		hillshade(data, width, height, 926.0f, 926.0f, 315.0f, 45.0f, shade);
+	double simd = (now() - start) / REPEAT;
+	int error = 0;
+	for(unsigned int i = 0; i < width*height; i++)
+		if(abs(shade[i] - reference[i]) > error) error = abs(shade[i] - reference[i]);
+	report("hillshade", scalar, simd);
+	printf("             max error %d\n", error);
+	free(reference);
+	free(shade);
+}
+
+// direct ECEF in double per sample, for checking the precision of projectGrid
+void projectReference(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double dim, int projection, double *center, double *points){
+	double radians = M_PI / 180.0;
+	double lat0 = (latitude - height*.5*dim) * radians, lon0 = (longitude + width*.5*dim) * radians;
+	for(unsigned int r = 0; r < height; r++){
+		for(unsigned int c = 0; c < width; c++){
+			double lat = (latitude - r*dim) * radians, lon = (longitude + c*dim) * radians;
+			double h = (data[r*width+c] == DEM_NODATA) ? 0.0 : data[r*width+c] * 0.001;
+			double N = WGS84_A / sqrt(1.0 - WGS84_E2*sin(lat)*sin(lat));
+			double X = (N+h)*cos(lat)*cos(lon) - center[0];
+			double Y = (N+h)*cos(lat)*sin(lon) - center[1];
+			double Z = (N*(1.0-WGS84_E2)+h)*sin(lat) - center[2];
+			double *p = &points[(r*width+c)*3];
+			if(projection == DEM_PROJECTION_ECEF){
+				p[0] = X; p[1] = Y; p[2] = Z;
+			}
+			else{
+				p[0] = -sin(lon0)*X + cos(lon0)*Y;
+				p[1] = -sin(lat0)*cos(lon0)*X - sin(lat0)*sin(lon0)*Y + cos(lat0)*Z;
+				p[2] = cos(lat0)*cos(lon0)*X + cos(lat0)*sin(lon0)*Y + sin(lat0)*Z;
+			}
+		}
+	}
+}
+
+void benchProjection(int16_t *data, unsigned int width, unsigned int height){
+	// a 30 arc-second grid at 60 degrees north
+	double dim = 30.0 / 3600.0, latitude = 60.0 + height*.5*dim, longitude = 10.0 - width*.5*dim;
+	float *points = (float*)malloc(sizeof(float) * width*height*3);
+	double *reference = (double*)malloc(sizeof(double) * width*height*3);
+	double start = now();
+	for(int i = 0; i < REPEAT; i++)
+		gridPoints(data, width, height, points);
+	double flat = (now() - start) / REPEAT;
+	printf("projection   flat grid %8.2f ms\n", flat*1000.0);
+	const char *names[] = { "", "tangent", "ecef" };
+	for(int projection = DEM_PROJECTION_TANGENT; projection <= DEM_PROJECTION_ECEF; projection++){
+		double center[3];
+		start = now();
+		for(int i = 0; i < REPEAT; i++)
+			projectGridScalar(data, width, height, latitude, longitude, dim, dim, projection, center, points);
+		double scalar = (now() - start) / REPEAT;
+		start = now();
+		for(int i = 0; i < REPEAT; i++)
+			projectGrid(data, width, height, latitude, longitude, dim, dim, projection, center, points);
+		double simd = (now() - start) / REPEAT;
+		projectReference(data, width, height, latitude, longitude, dim, projection, center, reference);
+		double error = 0.0;
+		for(unsigned int i = 0; i < width*height*3; i++)
+			if(fabs(points[i] - reference[i]) > error) error = fabs(points[i] - reference[i]);
+		report(names[projection], scalar, simd);
+		printf("             %.2fx flat grid, max error %.3f m\n", simd/flat, error*1000.0);
+	}
+	free(points);
+	free(reference);
+}
+
+void benchResample(int16_t *data, unsigned int width, unsigned int height){
+	const char *names[] = { "nearest", "box", "bilinear" };
+	// shrink to a quarter, and enlarge the middle of the grid to twice the size
+	unsigned int outWidth[2] = { width/4 ? width/4 : 1, width*2 };
+	unsigned int outHeight[2] = { height/4 ? height/4 : 1, height*2 };
+	double span[2] = { 1.0, 0.5 };
+	for(int s = 0; s < 2; s++){
+		double x = width*(1.0-span[s])*.5, y = height*(1.0-span[s])*.5;
+		for(int filter = DEM_RESAMPLE_NEAREST; filter <= DEM_RESAMPLE_BILINEAR; filter++){
+			int16_t *reference = NULL, *resampled = NULL;
+			double start = now();
+			for(int i = 0; i < REPEAT; i++){
+				free(reference);
+				reference = resampleDEMScalar(data, width, height, x, y, width*span[s], height*span[s], outWidth[s], outHeight[s], filter);
+			}
+			double scalar = (now() - start) / REPEAT;
+			start = now();
+			for(int i = 0; i < REPEAT; i++){
+				free(resampled);
+				resampled = resampleDEM(data, width, height, x, y, width*span[s], height*span[s], outWidth[s], outHeight[s], filter);
+			}
+			double simd = (now() - start) / REPEAT;
+			int error = 0;
+			for(unsigned int i = 0; i < outWidth[s]*outHeight[s]; i++)
+				if(abs(resampled[i] - reference[i]) > error) error = abs(resampled[i] - reference[i]);
+			char name[32];
+			snprintf(name, sizeof(name), "%s %s", names[filter], s ? "2x" : "1/4");
+			report(name, scalar, simd);
+			printf("             %u x %u, max error %d\n", outWidth[s], outHeight[s], error);
+			free(reference);
+			free(resampled);
+		}
+	}
+}
+
+void benchOceanCulling(int16_t *data, unsigned int width, unsigned int height){
+	unsigned int numTriangles = 2*(width-1)*(height-1);
+	uint32_t *indices = (uint32_t*)malloc(sizeof(uint32_t) * numTriangles*3);
+	float *points = (float*)malloc(sizeof(float) * width*height*3);
+	gridPoints(data, width, height, points);
+	double start = now();
+	unsigned int numIndices = gridTriangleIndicesCulled(data, width, height, indices);
+	float *streams[1] = { points };
+	unsigned int numPoints = compactVertices(indices, numIndices, width*height, streams, 1);
+	double elapsed = now() - start;
+	printf("ocean cull   %u of %u triangles culled (%.0f%%), %u of %u points kept  (%.1f ms)\n",
+		numTriangles - numIndices/3, numTriangles, 100.0 * (numTriangles - numIndices/3) / numTriangles,
+		numPoints, width*height, elapsed*1000.0);
+	free(indices);
+	free(points);
+}
+
+void benchRender(int16_t *data, unsigned int width, unsigned int height){
+	float *points = (float*)malloc(sizeof(float) * width*height*3);
+	float *normals = (float*)malloc(sizeof(float) * width*height*3);
+	float *colors = (float*)malloc(sizeof(float) * width*height*3);
+	uint32_t *indices = (uint32_t*)malloc(sizeof(uint32_t) * 6*(width-1)*(height-1));
+	gridPoints(data, width, height, points);
+	elevationNormals(data, width, height, 1.0f, 1.0f, normals);
+	elevationColors(data, width*height, colors);
+	unsigned int numIndices = gridTriangleIndices(width, height, indices);
+	struct renderTarget *target = renderTargetCreate(800, 400);
+	struct renderCamera camera = renderDefaultCamera();
+	camera.rotationY = -30.0f;
+	double start = now();
+	for(int i = 0; i < REPEAT; i++){
+		renderClear(target);
+		renderTriangles(target, camera, points, normals, colors, indices, width*height, numIndices);
+	}
+	double elapsed = (now() - start) / REPEAT;
+	printf("render       %u triangles at 800 x 400: %.2f ms, %.1f frames per second\n", numIndices/3, elapsed*1000.0, 1.0/elapsed);
+	renderTargetFree(target);
+	free(points);
+	free(normals);
+	free(colors);
+	free(indices);
+}
+
+void benchVertexCache(unsigned int width, unsigned int height){
+	unsigned int numTriangleIndices = 6*(width-1)*(height-1);
+	uint32_t *triangles = (uint32_t*)malloc(sizeof(uint32_t) * numTriangleIndices);
+	uint32_t *strip = (uint32_t*)malloc(sizeof(uint32_t) * (2*width+1)*(height-1));
+	gridTriangleIndices(width, height, triangles);
+	unsigned int numStripIndices = gridTriangleStripIndices(width, height, strip);
+	printf("ACMR         cache   row major   strip   tipsify\n");
+	for(unsigned int cacheSize = 8; cacheSize <= 32; cacheSize *= 2){
+		uint32_t *optimized = (uint32_t*)malloc(sizeof(uint32_t) * numTriangleIndices);
+		memcpy(optimized, triangles, sizeof(uint32_t) * numTriangleIndices);
+		double start = now();
+		optimizeVertexCache(optimized, numTriangleIndices, width*height, cacheSize);
+		double elapsed = now() - start;
+		printf("             %5u   %9.3f   %5.3f   %7.3f  (%.1f ms)\n", cacheSize,
+			averageCacheMissRatio(triangles, numTriangleIndices, cacheSize, 0),
+			averageCacheMissRatio(strip, numStripIndices, cacheSize, 1),
+			averageCacheMissRatio(optimized, numTriangleIndices, cacheSize, 0), elapsed*1000.0);
+		free(optimized);
+	}
+	free(triangles);
+	free(strip);
+}
+
+int main(int argc, char **argv){
+	unsigned int width = (argc > 1) ? atoi(argv[1]) : 2400;
+	unsigned int height = (argc > 2) ? atoi(argv[2]) : 2400;
+	printf("%u x %u grid, %u threads\n", width, height, demThreadCount());
+	int16_t *data = syntheticTerrain(width, height);
+	benchNormals(data, width, height);
+	benchHillshade(data, width, height);
+	benchProjection(data, width, height);
+	benchResample(data, width, height);
+	if(width > 1 && height > 1){
+		benchOceanCulling(data, width, height);
+		benchRender(data, width, height);
+		benchVertexCache(width, height);
+	}
+	free(data);
+	return 0;
+}
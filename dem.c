@@ -5,15 +5,14 @@
 //
 
 #include <stdio.h>
-
-struct demMeta {
-    unsigned int nrows;
-    unsigned int ncols;
-    double ulxmap;
-    double ulymap;
-    double xdim;
-    double ydim;
-};
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #include "dem.h"
 
@@ -169,48 +168,332 @@ void checkBoundaries(struct demMeta meta, unsigned int *x, unsigned int *y, unsi
 }
 
 
-void elevationPointCloud(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **colors, unsigned int *numPoints){
-    if(!width || !height)
+// MULTITHREADING
+//   rows are split into contiguous bands, one band per core
+struct demRowBand {
+    void (*kernel)(void *context, unsigned int start, unsigned int end);
+    void *context;
+    unsigned int start;
+    unsigned int end;
+};
+
+static void* demRowBandThread(void *arg){
+    struct demRowBand *band = (struct demRowBand*)arg;
+    band->kernel(band->context, band->start, band->end);
+    return NULL;
+}
+
+unsigned int demThreadCount(){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1) return 1;
+    if(cores > DEM_MAX_THREADS) return DEM_MAX_THREADS;
+    return (unsigned int)cores;
+}
+
+void parallelRows(unsigned int count, unsigned int minRowsPerThread, void (*kernel)(void *context, unsigned int start, unsigned int end), void *context){
+    if(!count)
         return;
-    
-    // load meta data from header
-    struct demMeta meta = loadHeader(directory, filename);
-    
+    if(!minRowsPerThread)
+        minRowsPerThread = 1;
+    unsigned int numThreads = demThreadCount();
+    if(numThreads > count / minRowsPerThread)
+        numThreads = count / minRowsPerThread;
+    if(numThreads <= 1){
+        kernel(context, 0, count);
+        return;
+    }
+    pthread_t threads[DEM_MAX_THREADS];
+    struct demRowBand bands[DEM_MAX_THREADS];
+    unsigned int started = 0;
+    for(unsigned int t = 0; t < numThreads; t++){
+        bands[t].kernel = kernel;
+        bands[t].context = context;
+        bands[t].start = (unsigned int)((uint64_t)count * t / numThreads);
+        bands[t].end = (unsigned int)((uint64_t)count * (t+1) / numThreads);
+        // band 0 runs on the calling thread
+        if(t == 0) continue;
+        if(pthread_create(&threads[t], NULL, demRowBandThread, &bands[t]) != 0)
+            break;
+        started = t;
+    }
+    // if a thread failed to spawn, the calling thread picks up the remaining bands
+    for(unsigned int t = started+1; t < numThreads; t++)
+        kernel(context, bands[t].start, bands[t].end);
+    kernel(context, bands[0].start, bands[0].end);
+    for(unsigned int t = 1; t <= started; t++)
+        pthread_join(threads[t], NULL);
+}
+
+
+// NORMALS AND HILLSHADE
+//   gradients by central differences, one-sided along the border.
+//   no-data samples are treated as sea level, the same as the mesh builders
+static inline float elevationOrZero(int16_t elevation){
+    return (elevation == DEM_NODATA) ? 0.0f : (float)elevation;
+}
+
+// neighbor rows and reciprocal distance between them for row h
+static inline void centralRows(unsigned int h, unsigned int height, float spacing, unsigned int *up, unsigned int *down, float *inverse){
+    *up = (h > 0) ? h-1 : h;
+    *down = (h+1 < height) ? h+1 : h;
+    *inverse = (*down > *up) ? 1.0f / ((*down - *up) * spacing) : 0.0f;
+}
+
+// gradient at column w of a row, dz/dx and dz/dy (toward increasing row)
+static inline void centralGradient(const int16_t *above, const int16_t *row, const int16_t *below, unsigned int w, unsigned int width, float xSpacing, float inverseY, float *gx, float *gy){
+    unsigned int left = (w > 0) ? w-1 : w;
+    unsigned int right = (w+1 < width) ? w+1 : w;
+    float inverseX = (right > left) ? 1.0f / ((right - left) * xSpacing) : 0.0f;
+    *gx = (elevationOrZero(row[right]) - elevationOrZero(row[left])) * inverseX;
+    *gy = (elevationOrZero(below[w]) - elevationOrZero(above[w])) * inverseY;
+}
+
+struct demGradientJob {
+    const int16_t *data;
+    unsigned int width;
+    unsigned int height;
+    float xSpacing;
+    float ySpacing;
+    float light[3];       // hillshade only, (east, north, up)
+    float *normals;
+    unsigned char *shade;
+};
+
+static inline void writeNormal(float *normal, float gx, float gy){
+    float length = sqrtf(gx*gx + gy*gy + 1.0f);
+    normal[0] = -gx / length;
+    normal[1] = -gy / length;
+    normal[2] = 1.0f / length;
+}
+
+// points run +x east and +y south, north is -y
+static inline unsigned char shadeValue(const float *light, float gx, float gy){
+    float lambert = (-gx*light[0] + gy*light[1] + light[2]) / sqrtf(gx*gx + gy*gy + 1.0f);
+    if(lambert <= 0.0f) return 0;
+    return (unsigned char)(lambert * 255.0f + 0.5f);
+}
+
+static void normalsScalarKernel(void *context, unsigned int start, unsigned int end){
+    struct demGradientJob *job = (struct demGradientJob*)context;
+    unsigned int width = job->width;
+    for(unsigned int h = start; h < end; h++){
+        unsigned int up, down;
+        float inverseY;
+        centralRows(h, job->height, job->ySpacing, &up, &down, &inverseY);
+        const int16_t *above = &job->data[up*width], *row = &job->data[h*width], *below = &job->data[down*width];
+        for(unsigned int w = 0; w < width; w++){
+            float gx, gy;
+            centralGradient(above, row, below, w, width, job->xSpacing, inverseY, &gx, &gy);
+            writeNormal(&job->normals[(h*width+w)*3], gx, gy);
+        }
+    }
+}
+
+static void hillshadeScalarKernel(void *context, unsigned int start, unsigned int end){
+    struct demGradientJob *job = (struct demGradientJob*)context;
+    unsigned int width = job->width;
+    for(unsigned int h = start; h < end; h++){
+        unsigned int up, down;
+        float inverseY;
+        centralRows(h, job->height, job->ySpacing, &up, &down, &inverseY);
+        const int16_t *above = &job->data[up*width], *row = &job->data[h*width], *below = &job->data[down*width];
+        for(unsigned int w = 0; w < width; w++){
+            float gx, gy;
+            centralGradient(above, row, below, w, width, job->xSpacing, inverseY, &gx, &gy);
+            job->shade[h*width+w] = shadeValue(job->light, gx, gy);
+        }
+    }
+}
+
+#ifdef __SSE2__
+// 4 int16 samples -> 4 floats, no-data becomes 0
+static inline __m128 loadElevation4(const int16_t *p){
+    __m128i v = _mm_loadl_epi64((const __m128i*)p);
+    v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    v = _mm_andnot_si128(_mm_cmpeq_epi32(v, _mm_set1_epi32(DEM_NODATA)), v);
+    return _mm_cvtepi32_ps(v);
+}
+
+// transpose (xxxx)(yyyy)(zzzz) into (xyzx)(yzxy)(zxyz), 4 (x,y,z) triples
+static inline void storeInterleaved3(float *out, __m128 x, __m128 y, __m128 z){
+    __m128 xy01 = _mm_unpacklo_ps(x, y);                            // x0 y0 x1 y1
+    __m128 xy23 = _mm_unpackhi_ps(x, y);                            // x2 y2 x3 y3
+    __m128 zxy1 = _mm_shuffle_ps(z, xy01, _MM_SHUFFLE(3,2,1,0));    // z0 z1 x1 y1
+    __m128 zxy3 = _mm_shuffle_ps(z, xy23, _MM_SHUFFLE(3,2,3,2));    // z2 z3 x3 y3
+    _mm_storeu_ps(&out[0], _mm_shuffle_ps(xy01, zxy1, _MM_SHUFFLE(2,0,1,0)));
+    _mm_storeu_ps(&out[4], _mm_shuffle_ps(zxy1, xy23, _MM_SHUFFLE(1,0,1,3)));
+    _mm_storeu_ps(&out[8], _mm_shuffle_ps(zxy3, zxy3, _MM_SHUFFLE(1,3,2,0)));
+}
+
+static void normalsSIMDKernel(void *context, unsigned int start, unsigned int end){
+    struct demGradientJob *job = (struct demGradientJob*)context;
+    unsigned int width = job->width;
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 inverseX4 = _mm_set1_ps(0.5f / job->xSpacing);
+    for(unsigned int h = start; h < end; h++){
+        unsigned int up, down;
+        float inverseY;
+        centralRows(h, job->height, job->ySpacing, &up, &down, &inverseY);
+        const int16_t *above = &job->data[up*width], *row = &job->data[h*width], *below = &job->data[down*width];
+        float *normals = &job->normals[h*width*3];
+        float gx, gy;
+        centralGradient(above, row, below, 0, width, job->xSpacing, inverseY, &gx, &gy);
+        writeNormal(&normals[0], gx, gy);
+        unsigned int w = 1;
+        __m128 inverseY4 = _mm_set1_ps(inverseY);
+        for(; w + 4 < width; w += 4){
+            __m128 gx4 = _mm_mul_ps(_mm_sub_ps(loadElevation4(&row[w+1]), loadElevation4(&row[w-1])), inverseX4);
+            __m128 gy4 = _mm_mul_ps(_mm_sub_ps(loadElevation4(&below[w]), loadElevation4(&above[w])), inverseY4);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx4, gx4), _mm_mul_ps(gy4, gy4)), one));
+            __m128 x = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), gx4), length);
+            __m128 y = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), gy4), length);
+            __m128 z = _mm_div_ps(one, length);
+            storeInterleaved3(&normals[w*3], x, y, z);
+        }
+        for(; w < width; w++){
+            centralGradient(above, row, below, w, width, job->xSpacing, inverseY, &gx, &gy);
+            writeNormal(&normals[w*3], gx, gy);
+        }
+    }
+}
+
+static void hillshadeSIMDKernel(void *context, unsigned int start, unsigned int end){
+    struct demGradientJob *job = (struct demGradientJob*)context;
+    unsigned int width = job->width;
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 lightX = _mm_set1_ps(-job->light[0]);
+    __m128 lightY = _mm_set1_ps(job->light[1]);
+    __m128 lightZ = _mm_set1_ps(job->light[2]);
+    __m128 scale = _mm_set1_ps(255.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 inverseX4 = _mm_set1_ps(0.5f / job->xSpacing);
+    for(unsigned int h = start; h < end; h++){
+        unsigned int up, down;
+        float inverseY;
+        centralRows(h, job->height, job->ySpacing, &up, &down, &inverseY);
+        const int16_t *above = &job->data[up*width], *row = &job->data[h*width], *below = &job->data[down*width];
+        unsigned char *shade = &job->shade[h*width];
+        __m128 inverseY4 = _mm_set1_ps(inverseY);
+        float gx, gy;
+        centralGradient(above, row, below, 0, width, job->xSpacing, inverseY, &gx, &gy);
+        shade[0] = shadeValue(job->light, gx, gy);
+        unsigned int w = 1;
+        for(; w + 4 < width; w += 4){
+            __m128 gx4 = _mm_mul_ps(_mm_sub_ps(loadElevation4(&row[w+1]), loadElevation4(&row[w-1])), inverseX4);
+            __m128 gy4 = _mm_mul_ps(_mm_sub_ps(loadElevation4(&below[w]), loadElevation4(&above[w])), inverseY4);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx4, gx4), _mm_mul_ps(gy4, gy4)), one));
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx4, lightX), _mm_mul_ps(gy4, lightY)), lightZ);
+            __m128 lambert = _mm_max_ps(_mm_div_ps(dot, length), _mm_setzero_ps());
+            __m128i value = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(lambert, scale), half));
+            value = _mm_packs_epi32(value, value);
+            value = _mm_packus_epi16(value, value);
+            int packed = _mm_cvtsi128_si32(value);
+            memcpy(&shade[w], &packed, 4);
+        }
+        for(; w < width; w++){
+            centralGradient(above, row, below, w, width, job->xSpacing, inverseY, &gx, &gy);
+            shade[w] = shadeValue(job->light, gx, gy);
+        }
+    }
+}
+#endif
+
+void elevationNormalsScalar(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float *normals){
+    struct demGradientJob job = { data, width, height, xSpacing, ySpacing, {0,0,0}, normals, NULL };
+    normalsScalarKernel(&job, 0, height);
+}
+
+void elevationNormals(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float *normals){
+    struct demGradientJob job = { data, width, height, xSpacing, ySpacing, {0,0,0}, normals, NULL };
+#ifdef __SSE2__
+    parallelRows(height, 64, normalsSIMDKernel, &job);
+#else
+    parallelRows(height, 64, normalsScalarKernel, &job);
+#endif
+}
+
+static void lightDirection(float azimuth, float altitude, float *light){
+    float az = azimuth * M_PI / 180.0;
+    float alt = altitude * M_PI / 180.0;
+    light[0] = sinf(az) * cosf(alt);   // east
+    light[1] = cosf(az) * cosf(alt);   // north
+    light[2] = sinf(alt);              // up
+}
+
+void hillshadeScalar(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float azimuth, float altitude, unsigned char *shade){
+    struct demGradientJob job = { data, width, height, xSpacing, ySpacing, {0,0,0}, NULL, shade };
+    lightDirection(azimuth, altitude, job.light);
+    hillshadeScalarKernel(&job, 0, height);
+}
+
+void hillshade(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float azimuth, float altitude, unsigned char *shade){
+    struct demGradientJob job = { data, width, height, xSpacing, ySpacing, {0,0,0}, NULL, shade };
+    lightDirection(azimuth, altitude, job.light);
+#ifdef __SSE2__
+    parallelRows(height, 64, hillshadeSIMDKernel, &job);
+#else
+    parallelRows(height, 64, hillshadeScalarKernel, &job);
+#endif
+}
+
+
+// MESH BUILDING
+//   top left corner of a width x height rectangle centered on lat/lon, moved or shrunk to fit the tile
+//   returns 0 if there is nothing to crop
+static int rectangleAroundGeoLocation(struct demMeta meta, float latitude, float longitude, unsigned int *width, unsigned int *height, unsigned int *topColumn, unsigned int *topRow){
+    if(!*width || !*height)
+        return 0;
+
     // convert lat/lon into column/row for plate
     unsigned int row, column;
     getByteColumnRowFromGeoLocation(meta, latitude, longitude, &column, &row);
-    
+
     // shift center point to top left, and check boundaries
-    column -= width*.5;
-    row -= height*.5;
-    checkBoundaries(meta, &column, &row, &width, &height);
-    printf("Columns:(%d to %d)\nRows:(%d to %d)\n",column, column+width, row, row+height);
+    column -= *width*.5;
+    row -= *height*.5;
+    checkBoundaries(meta, &column, &row, width, height);
+    *topColumn = column;
+    *topRow = row;
+    return 1;
+}
+
+//   crops a width x height rectangle centered on latitude, longitude.
+//   width and height may shrink to fit the tile, NULL if nothing to crop
+//   top left column and row of the crop are returned if not NULL
+static int16_t* cropAroundGeoLocation(char *directory, char *filename, struct demMeta meta, float latitude, float longitude, unsigned int *width, unsigned int *height, unsigned int *topColumn, unsigned int *topRow){
+    unsigned int row, column;
+    if(!rectangleAroundGeoLocation(meta, latitude, longitude, width, height, &column, &row))
+        return NULL;
+    printf("Columns:(%d to %d)\nRows:(%d to %d)\n",column, column+*width, row, row+*height);
+    if(topColumn != NULL) *topColumn = column;
+    if(topRow != NULL) *topRow = row;
 
     // crop DEM and load it into memory
-    int16_t *data = cropDEMWithMeta(directory, filename, meta, column, row, width, height);
-    
-    // empty point cloud, (x, y, z)
-    (*points) = (float*)malloc(sizeof(float) * width*height * 3);
-    
+    return cropDEMWithMeta(directory, filename, meta, column, row, *width, *height);
+}
+
+// (x, y, z) per sample, centered on the rectangle. 1 unit per cell, z in meters
+static void gridPoints(int16_t *data, unsigned int width, unsigned int height, float *points){
     for(int h = 0; h < height; h++){
         for(int w = 0; w < width; w++){
-            (*points)[(h*width+w)*3+0] = (w - width*.5);         // x
-            (*points)[(h*width+w)*3+1] = (h - height*.5);        // y
+            points[(h*width+w)*3+0] = (w - width*.5);         // x
+            points[(h*width+w)*3+1] = (h - height*.5);        // y
             int16_t elev = data[h*width+w];
-            if(elev == -9999)
-                (*points)[(h*width+w)*3+2] = 0.0f;///1000.0;    // z, convert meters to km
+            if(elev == DEM_NODATA)
+                points[(h*width+w)*3+2] = 0.0f;///1000.0;    // z, convert meters to km
             else
-                (*points)[(h*width+w)*3+2] = data[h*width+w];///1000.0;    // z, convert meters to km
+                points[(h*width+w)*3+2] = elev;///1000.0;    // z, convert meters to km
         }
     }
-    
-    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
-    
-    for(int i = 0; i < width*height; i++){
-        if(data[i] == -9999){
-            (*colors)[i*3+0] = 0.0f;
-            (*colors)[i*3+1] = 0.24f;
-            (*colors)[i*3+2] = 0.666f;
+}
+
+// (r, g, b) per sample: ocean blue, lowland orange to green, highland green to white
+static void elevationColors(int16_t *data, unsigned int count, float *colors){
+    for(int i = 0; i < count; i++){
+        if(data[i] == DEM_NODATA){
+            colors[i*3+0] = 0.0f;
+            colors[i*3+1] = 0.24f;
+            colors[i*3+2] = 0.666f;
         }
         else if(data[i] > 400){
             float white = (data[i]-400) / 400.0;
@@ -219,188 +502,956 @@ void elevationPointCloud(char *directory, char *filename, float latitude, float
         // else if(data[i] > 900){
         //     float white = (data[i]-900) / 300.0;
             if(white > 1.0f) white = 1.0f;
-            (*colors)[i*3+0] = white;
-            (*colors)[i*3+1] = 0.3f + 0.7f*white;
-            (*colors)[i*3+2] = white;
+            colors[i*3+0] = white;
+            colors[i*3+1] = 0.3f + 0.7f*white;
+            colors[i*3+2] = white;
         }
         else if(data[i] > 100){
             float dark = (data[i]-100) / 300.0;
             if(dark > 1.0f) dark = 1.0f;
-            (*colors)[i*3+0] = 0.0f;
-            (*colors)[i*3+1] = 0.5f - 0.2f*dark;
-            (*colors)[i*3+2] = 0.0f;
+            colors[i*3+0] = 0.0f;
+            colors[i*3+1] = 0.5f - 0.2f*dark;
+            colors[i*3+2] = 0.0f;
         }
         else{
             float orange = (100-data[i]) / 100.0;
             if(orange < 0.0f) orange = 0.0f;
-            (*colors)[i*3+0] = orange * .85;
-            (*colors)[i*3+1] = 0.5f;
-            (*colors)[i*3+2] = 0.0;
+            colors[i*3+0] = orange * .85;
+            colors[i*3+1] = 0.5f;
+            colors[i*3+2] = 0.0;
         }
     }
+}
+
+unsigned int gridTriangleIndices(unsigned int width, unsigned int height, uint32_t *indices){
+    if(width < 2 || height < 2)
+        return 0;
+    // inside INDICES, (width-1) and (height-1) are max
+    // inside POINTS, width and height are max
+    for(int h = 0; h < height-1; h++){
+        for(int w = 0; w < width-1; w++){
+            indices[(h*(width-1)+w)*6+0] = 1*(h*width+w);
+            indices[(h*(width-1)+w)*6+1] = 1*((h+1)*width+w);
+            indices[(h*(width-1)+w)*6+2] = 1*(h*width+w+1);
+            indices[(h*(width-1)+w)*6+3] = 1*((h+1)*width+w);
+            indices[(h*(width-1)+w)*6+4] = 1*((h+1)*width+w+1);
+            indices[(h*(width-1)+w)*6+5] = 1*(h*width+w+1);
+        }
+    }
+    return 2*(width-1)*(height-1)*3;
+}
+
+unsigned int gridTriangleStripIndices(unsigned int width, unsigned int height, uint32_t *indices){
+    if(width < 2 || height < 2)
+        return 0;
+    unsigned int n = 0;
+    for(unsigned int h = 0; h < height-1; h++){
+        if(h > 0)
+            indices[n++] = DEM_RESTART_INDEX;
+        // serpentine: odd rows run right to left and start where the last strip ended.
+        // the pair order flips with the direction so the winding stays the same
+        for(unsigned int q = 0; q < width; q++){
+            if(h%2 == 0){
+                indices[n++] = h*width+q;
+                indices[n++] = (h+1)*width+q;
+            }
+            else{
+                unsigned int w = width-1-q;
+                indices[n++] = (h+1)*width+w;
+                indices[n++] = h*width+w;
+            }
+        }
+    }
+    return n;
+}
+
+
+void elevationPointCloudWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, float **colors, unsigned int *numPoints){
+    // load meta data from header
+    struct demMeta meta = loadHeader(directory, filename);
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, NULL, NULL);
+    if(data == NULL)
+        return;
+
+    // empty point cloud, (x, y, z)
+    (*points) = (float*)malloc(sizeof(float) * width*height * 3);
+    gridPoints(data, width, height, *points);
+
+    // optional normals (x, y, z), one per point, in the same units as points
+    if(normals != NULL){
+        (*normals) = (float*)malloc(sizeof(float) * width*height * 3);
+        elevationNormals(data, width, height, 1.0f, 1.0f, *normals);
+    }
+
+    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
+    elevationColors(data, width*height, *colors);
+
+    *numPoints = height * width;
+    free(data);
+}
+
+
+void elevationPointCloud(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **colors, unsigned int *numPoints){
+    elevationPointCloudWithNormals(directory, filename, latitude, longitude, width, height, points, NULL, colors, numPoints);
+}
+
+
+void elevationTrianglesWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
+    // load meta data from header
+    struct demMeta meta = loadHeader(directory, filename);
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, NULL, NULL);
+    if(data == NULL)
+        return;
+
+    // empty point cloud, (x, y, z)
+    (*points) = (float*)malloc(sizeof(float) * width*height * 3);
+    gridPoints(data, width, height, *points);
+
+    // optional normals (x, y, z), one per point, in the same units as points
+    if(normals != NULL){
+        (*normals) = (float*)malloc(sizeof(float) * width*height * 3);
+        elevationNormals(data, width, height, 1.0f, 1.0f, *normals);
+    }
+
+    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * 2*(width-1)*(height-1) * 3);
+    *numIndices = gridTriangleIndices(width, height, *indices);
+
+    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
+    elevationColors(data, width*height, *colors);
+
     *numPoints = height * width;
+    free(data);
 }
 
 
 void elevationTriangles(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
-    if(!width || !height)
+    elevationTrianglesWithNormals(directory, filename, latitude, longitude, width, height, points, NULL, indices, colors, numPoints, numIndices);
+}
+
+
+void elevationHillshade(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float azimuth, float altitude, unsigned char **shade){
+    // load meta data from header
+    struct demMeta meta = loadHeader(directory, filename);
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, NULL, NULL);
+    if(data == NULL)
         return;
-    
+
+    // cell size in meters, same unit as elevation. longitude cells narrow toward the poles
+    float ySpacing = meta.ydim * DEM_METERS_PER_DEGREE;
+    float xSpacing = meta.xdim * DEM_METERS_PER_DEGREE * cos(latitude * M_PI / 180.0);
+
+    (*shade) = (unsigned char*)malloc(sizeof(unsigned char) * width*height);
+    hillshade(data, width, height, xSpacing, ySpacing, azimuth, altitude, *shade);
+    free(data);
+}
+
+
+void elevationTriangleStrip(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
     // load meta data from header
     struct demMeta meta = loadHeader(directory, filename);
-    
-    // convert lat/lon into column/row for plate
-    unsigned int row, column;
-    getByteColumnRowFromGeoLocation(meta, latitude, longitude, &column, &row);
-    
-    // shift center point to top left, and check boundaries
-    column -= width*.5;
-    row -= height*.5;
-    checkBoundaries(meta, &column, &row, &width, &height);
-    printf("Columns:(%d to %d)\nRows:(%d to %d)\n",column, column+width, row, row+height);
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, NULL, NULL);
+    if(data == NULL)
+        return;
 
-    // crop DEM and load it into memory
-    int16_t *data = cropDEMWithMeta(directory, filename, meta, column, row, width, height);
-    
     // empty point cloud, (x, y, z)
     (*points) = (float*)malloc(sizeof(float) * width*height * 3);
-    
-    for(int h = 0; h < height; h++){
-        for(int w = 0; w < width; w++){
-            (*points)[(h*width+w)*3+0] = (w - width*.5);         // x
-            (*points)[(h*width+w)*3+1] = (h - height*.5);        // y
-            int16_t elev = data[h*width+w];
-            if(elev == -9999)
-                (*points)[(h*width+w)*3+2] = 0.0f;///1000.0;    // z, convert meters to km
-            else
-                (*points)[(h*width+w)*3+2] = data[h*width+w];///1000.0;    // z, convert meters to km
+    gridPoints(data, width, height, *points);
+
+    // one strip per row of quads, each 2*width long, separated by a restart index
+    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * (2*width+1)*(height-1));
+    *numIndices = gridTriangleStripIndices(width, height, *indices);
+
+    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
+    elevationColors(data, width*height, *colors);
+
+    *numPoints = height * width;
+    free(data);
+}
+
+
+// OCEAN CULLING
+//   quads whose four corners are all no-data are left out of the index buffer
+unsigned int gridTriangleIndicesCulled(int16_t *data, unsigned int width, unsigned int height, uint32_t *indices){
+    if(width < 2 || height < 2)
+        return 0;
+    unsigned int n = 0;
+    for(unsigned int h = 0; h < height-1; h++){
+        for(unsigned int w = 0; w < width-1; w++){
+            if(data[h*width+w] == DEM_NODATA && data[h*width+w+1] == DEM_NODATA &&
+               data[(h+1)*width+w] == DEM_NODATA && data[(h+1)*width+w+1] == DEM_NODATA)
+                continue;
+            indices[n++] = h*width+w;
+            indices[n++] = (h+1)*width+w;
+            indices[n++] = h*width+w+1;
+            indices[n++] = (h+1)*width+w;
+            indices[n++] = (h+1)*width+w+1;
+            indices[n++] = h*width+w+1;
         }
     }
+    return n;
+}
 
-    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * 2*(width-1)*(height-1) * 3);
+unsigned int compactVertices(uint32_t *indices, unsigned int numIndices, unsigned int numPoints, float **streams, unsigned int numStreams){
+    uint32_t *remap = (uint32_t*)malloc(sizeof(uint32_t) * numPoints);
+    for(unsigned int v = 0; v < numPoints; v++)
+        remap[v] = DEM_RESTART_INDEX;
+    for(unsigned int i = 0; i < numIndices; i++)
+        if(indices[i] != DEM_RESTART_INDEX)
+            remap[indices[i]] = 0;
+    // new indices keep the original order, so every vertex moves toward the front and
+    // the streams can be compacted in place
+    unsigned int count = 0;
+    for(unsigned int v = 0; v < numPoints; v++){
+        if(remap[v] == DEM_RESTART_INDEX) continue;
+        for(unsigned int s = 0; s < numStreams; s++)
+            if(streams[s] != NULL && count != v)
+                memmove(&streams[s][count*3], &streams[s][v*3], sizeof(float) * 3);
+        remap[v] = count++;
+    }
+    for(unsigned int i = 0; i < numIndices; i++)
+        if(indices[i] != DEM_RESTART_INDEX)
+            indices[i] = remap[indices[i]];
+    free(remap);
+    return count;
+}
 
-    // inside INDICES, (width-1) and (height-1) are max
-    // inside POINTS, width and height are max
-    for(int h = 0; h < height-1; h++){
-        for(int w = 0; w < width-1; w++){
-            (*indices)[(h*(width-1)+w)*6+0] = 1*(h*width+w);
-            (*indices)[(h*(width-1)+w)*6+1] = 1*((h+1)*width+w);
-            (*indices)[(h*(width-1)+w)*6+2] = 1*(h*width+w+1);
-            (*indices)[(h*(width-1)+w)*6+3] = 1*((h+1)*width+w);
-            (*indices)[(h*(width-1)+w)*6+4] = 1*((h+1)*width+w+1);
-            (*indices)[(h*(width-1)+w)*6+5] = 1*(h*width+w+1);
+
+void elevationTrianglesCulled(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, int ocean, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices, unsigned int *numCulled){
+    // load meta data from header
+    struct demMeta meta = loadHeader(directory, filename);
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, NULL, NULL);
+    if(data == NULL)
+        return;
+
+    // room for 4 extra vertices and 2 triangles, the water plane
+    unsigned int capacity = width*height + 4;
+    (*points) = (float*)malloc(sizeof(float) * capacity * 3);
+    gridPoints(data, width, height, *points);
+    if(normals != NULL){
+        (*normals) = (float*)malloc(sizeof(float) * capacity * 3);
+        elevationNormals(data, width, height, 1.0f, 1.0f, *normals);
+    }
+    (*colors) = (float*)malloc(sizeof(float) * capacity * 3);
+    elevationColors(data, width*height, *colors);
+
+    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * (2*(width-1)*(height-1) + 2) * 3);
+    unsigned int total = (width > 1 && height > 1) ? 2*(width-1)*(height-1) : 0;
+    if(ocean == DEM_OCEAN_KEEP)
+        *numIndices = gridTriangleIndices(width, height, *indices);
+    else
+        *numIndices = gridTriangleIndicesCulled(data, width, height, *indices);
+    *numCulled = total - *numIndices/3;
+
+    float *streams[3] = { *points, (normals != NULL) ? *normals : NULL, *colors };
+    *numPoints = compactVertices(*indices, *numIndices, width*height, streams, 3);
+
+    if(ocean == DEM_OCEAN_PLANE && *numCulled){
+        // one quad over the whole rectangle, just under sea level so the coastline draws on top,
+        // and under the lowest land too (polders, Death Valley, the Dead Sea) so none is hidden
+        float depth = DEM_WATER_PLANE_DEPTH;
+        for(unsigned int i = 0; i < width*height; i++)
+            if(data[i] != DEM_NODATA && data[i] - 1.0f < depth)
+                depth = data[i] - 1.0f;
+        unsigned int corners[4][2] = { {0, 0}, {0, height-1}, {width-1, 0}, {width-1, height-1} };
+        for(int c = 0; c < 4; c++){
+            float *p = &(*points)[(*numPoints+c)*3];
+            p[0] = corners[c][0] - width*.5;
+            p[1] = corners[c][1] - height*.5;
+            p[2] = depth;
+            if(normals != NULL){
+                float *n = &(*normals)[(*numPoints+c)*3];
+                n[0] = 0.0f;
+                n[1] = 0.0f;
+                n[2] = 1.0f;
+            }
+            float *color = &(*colors)[(*numPoints+c)*3];
+            color[0] = 0.0f;
+            color[1] = 0.24f;
+            color[2] = 0.666f;
         }
+        uint32_t plane[6] = { 0, 1, 2, 1, 3, 2 };
+        for(int i = 0; i < 6; i++)
+            (*indices)[*numIndices+i] = *numPoints + plane[i];
+        *numIndices += 6;
+        *numPoints += 4;
     }
+    printf("Culled %d of %d triangles, %d of %d points remain\n", *numCulled, total, *numPoints, width*height);
 
-    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
-    
-    for(int i = 0; i < width*height; i++){
-        if(data[i] == -9999){
-            (*colors)[i*3+0] = 0.0f;
-            (*colors)[i*3+1] = 0.24f;
-            (*colors)[i*3+2] = 0.666f;
+    free(data);
+}
+
+
+// VERTEX CACHE
+//   simulates a FIFO post-transform cache over an index buffer
+float averageCacheMissRatio(uint32_t *indices, unsigned int numIndices, unsigned int cacheSize, int strip){
+    uint32_t numVertices = 0;
+    for(unsigned int i = 0; i < numIndices; i++)
+        if(indices[i] != DEM_RESTART_INDEX && indices[i] >= numVertices)
+            numVertices = indices[i]+1;
+    // miss count when each vertex last entered the cache, +1 so 0 means never
+    uint32_t *entered = (uint32_t*)calloc(numVertices ? numVertices : 1, sizeof(uint32_t));
+    unsigned int misses = 0, triangles = 0, run = 0;
+    for(unsigned int i = 0; i < numIndices; i++){
+        uint32_t v = indices[i];
+        if(v == DEM_RESTART_INDEX){
+            run = 0;
+            continue;
         }
-        else if(data[i] > 400){
-            float white = (data[i]-400) / 400.0;
-        // else if(data[i] > 1200){
-        //     float white = (data[i]-1200) / 500.0;
-        // else if(data[i] > 900){
-        //     float white = (data[i]-900) / 300.0;
-            if(white > 1.0f) white = 1.0f;
-            (*colors)[i*3+0] = white;
-            (*colors)[i*3+1] = 0.3f + 0.7f*white;
-            (*colors)[i*3+2] = white;
+        if(!entered[v] || misses - entered[v] >= cacheSize){
+            misses++;
+            entered[v] = misses;
         }
-        else if(data[i] > 100){
-            float dark = (data[i]-100) / 300.0;
-            if(dark > 1.0f) dark = 1.0f;
-            (*colors)[i*3+0] = 0.0f;
-            (*colors)[i*3+1] = 0.5f - 0.2f*dark;
-            (*colors)[i*3+2] = 0.0f;
+        run++;
+        if(strip && run >= 3) triangles++;
+    }
+    if(!strip) triangles = numIndices / 3;
+    free(entered);
+    return triangles ? (float)misses / triangles : 0.0f;
+}
+
+// Tipsify (Sander, Nehab, Barczak 2007): fans around one vertex at a time, then moves
+// to the neighbor that is still in the cache and has the most triangles left
+static int32_t tipsifyDeadEnd(uint32_t *deadEnd, unsigned int *deadEndSize, uint32_t *live, unsigned int numPoints, unsigned int *cursor){
+    while(*deadEndSize){
+        uint32_t v = deadEnd[--(*deadEndSize)];
+        if(live[v]) return v;
+    }
+    while(*cursor < numPoints){
+        if(live[*cursor]) return (*cursor)++;
+        (*cursor)++;
+    }
+    return -1;
+}
+
+void optimizeVertexCache(uint32_t *indices, unsigned int numIndices, unsigned int numPoints, unsigned int cacheSize){
+    unsigned int numTriangles = numIndices / 3;
+    if(!numTriangles || !numPoints)
+        return;
+    // vertex -> triangle adjacency, compressed rows
+    uint32_t *live = (uint32_t*)calloc(numPoints, sizeof(uint32_t));
+    uint32_t *offset = (uint32_t*)malloc(sizeof(uint32_t) * (numPoints+1));
+    uint32_t *adjacency = (uint32_t*)malloc(sizeof(uint32_t) * numTriangles*3);
+    for(unsigned int i = 0; i < numTriangles*3; i++)
+        live[indices[i]]++;
+    offset[0] = 0;
+    for(unsigned int v = 0; v < numPoints; v++)
+        offset[v+1] = offset[v] + live[v];
+    uint32_t *fill = (uint32_t*)malloc(sizeof(uint32_t) * numPoints);
+    memcpy(fill, offset, sizeof(uint32_t) * numPoints);
+    for(unsigned int i = 0; i < numTriangles*3; i++)
+        adjacency[fill[indices[i]]++] = i/3;
+    free(fill);
+
+    uint32_t *timestamp = (uint32_t*)calloc(numPoints, sizeof(uint32_t));
+    uint32_t *deadEnd = (uint32_t*)malloc(sizeof(uint32_t) * numTriangles*3);
+    uint32_t *candidates = (uint32_t*)malloc(sizeof(uint32_t) * numTriangles*3);
+    unsigned char *emitted = (unsigned char*)calloc(numTriangles, sizeof(unsigned char));
+    uint32_t *output = (uint32_t*)malloc(sizeof(uint32_t) * numTriangles*3);
+    unsigned int deadEndSize = 0, outputSize = 0, cursor = 0;
+    uint32_t time = cacheSize+1;
+
+    int32_t fan = tipsifyDeadEnd(deadEnd, &deadEndSize, live, numPoints, &cursor);
+    while(fan >= 0){
+        unsigned int numCandidates = 0;
+        for(uint32_t a = offset[fan]; a < offset[fan+1]; a++){
+            uint32_t t = adjacency[a];
+            if(emitted[t]) continue;
+            emitted[t] = 1;
+            for(int k = 0; k < 3; k++){
+                uint32_t v = indices[t*3+k];
+                output[outputSize++] = v;
+                deadEnd[deadEndSize++] = v;
+                candidates[numCandidates++] = v;
+                live[v]--;
+                if(time - timestamp[v] > cacheSize)
+                    timestamp[v] = time++;
+            }
         }
-        else{
-            float orange = (100-data[i]) / 100.0;
-            if(orange < 0.0f) orange = 0.0f;
-            (*colors)[i*3+0] = orange * .85;
-            (*colors)[i*3+1] = 0.5f;
-            (*colors)[i*3+2] = 0.0;
+        // next fan: the candidate still in cache with the most use left, else a dead end
+        int32_t next = -1;
+        int64_t best = -1;
+        for(unsigned int c = 0; c < numCandidates; c++){
+            uint32_t v = candidates[c];
+            if(!live[v]) continue;
+            int64_t priority = 0;
+            if(time - timestamp[v] + 2*live[v] <= cacheSize)
+                priority = time - timestamp[v];
+            if(priority > best){
+                best = priority;
+                next = v;
+            }
         }
+        if(next < 0)
+            next = tipsifyDeadEnd(deadEnd, &deadEndSize, live, numPoints, &cursor);
+        fan = next;
     }
+    memcpy(indices, output, sizeof(uint32_t) * outputSize);
 
-    *numPoints = height * width;
-    *numIndices = 2*(width-1)*(height-1)*3;
+    free(live);
+    free(offset);
+    free(adjacency);
+    free(timestamp);
+    free(deadEnd);
+    free(candidates);
+    free(emitted);
+    free(output);
 }
 
 
-void elevationTriangleStrip(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float *points, float *colors){
-    if(!width || !height)
+// PROJECTION
+//   positions on the WGS84 ellipsoid, in km, relative to the ECEF point at the origin.
+//   everything large is done once per row or column in double precision: per sample only
+//   small, center-relative terms are left, which float holds to well under a meter.
+//
+//   in a frame rotated by the origin's longitude (dl: longitude - origin longitude),
+//   with N the prime vertical radius and h the elevation
+//     x = (N + h) cos(lat) cos(dl)  y = (N + h) cos(lat) sin(dl)  z = (N(1-e^2) + h) sin(lat)
+//   cos(dl) is split into 1 + (cos(dl) - 1) so the origin cancels exactly in the row terms
+#define WGS84_A 6378.137               // km, equatorial radius
+#define WGS84_E2 0.00669437999014      // eccentricity squared
+
+struct demProjectionRow {
+    float a;        // N cos(lat), distance from the axis
+    float b;        // cos(lat)
+    float x;        // N cos(lat) - origin x
+    float z;        // N(1-e^2) sin(lat) - origin z
+    float d;        // sin(lat)
+};
+
+struct demProjectionJob {
+    const int16_t *data;
+    unsigned int width;
+    struct demProjectionRow *rows;
+    float *sines;       // per column sin(dl)
+    float *cosines;     // per column cos(dl) - 1
+    float matrix[9];    // rotated frame -> output frame, row major
+    float *points;
+};
+
+// (x, y, z) of one sample in the rotated frame, relative to the origin
+static inline void projectSample(const struct demProjectionRow *row, float s, float m, float h, float *p){
+    float q = row->a + h*row->b;
+    p[0] = row->x + h*row->b + q*m;
+    p[1] = q*s;
+    p[2] = row->z + h*row->d;
+}
+
+static void projectScalarKernel(void *context, unsigned int start, unsigned int end){
+    struct demProjectionJob *job = (struct demProjectionJob*)context;
+    const float *M = job->matrix;
+    for(unsigned int r = start; r < end; r++){
+        for(unsigned int c = 0; c < job->width; c++){
+            float p[3];
+            float h = elevationOrZero(job->data[r*job->width+c]) * 0.001f;   // meters to km
+            projectSample(&job->rows[r], job->sines[c], job->cosines[c], h, p);
+            float *out = &job->points[(r*job->width+c)*3];
+            out[0] = M[0]*p[0] + M[1]*p[1] + M[2]*p[2];
+            out[1] = M[3]*p[0] + M[4]*p[1] + M[5]*p[2];
+            out[2] = M[6]*p[0] + M[7]*p[1] + M[8]*p[2];
+        }
+    }
+}
+
+#ifdef __SSE2__
+static void projectSIMDKernel(void *context, unsigned int start, unsigned int end){
+    struct demProjectionJob *job = (struct demProjectionJob*)context;
+    unsigned int width = job->width;
+    __m128 M[9];
+    for(int i = 0; i < 9; i++)
+        M[i] = _mm_set1_ps(job->matrix[i]);
+    __m128 kilometers = _mm_set1_ps(0.001f);
+    for(unsigned int r = start; r < end; r++){
+        const struct demProjectionRow *row = &job->rows[r];
+        __m128 a = _mm_set1_ps(row->a), b = _mm_set1_ps(row->b);
+        __m128 rx = _mm_set1_ps(row->x), rz = _mm_set1_ps(row->z), d = _mm_set1_ps(row->d);
+        const int16_t *data = &job->data[r*width];
+        float *points = &job->points[r*width*3];
+        unsigned int c = 0;
+        for(; c + 4 <= width; c += 4){
+            __m128 h = _mm_mul_ps(loadElevation4(&data[c]), kilometers);
+            __m128 hb = _mm_mul_ps(h, b);
+            __m128 q = _mm_add_ps(a, hb);
+            __m128 px = _mm_add_ps(_mm_add_ps(rx, hb), _mm_mul_ps(q, _mm_loadu_ps(&job->cosines[c])));
+            __m128 py = _mm_mul_ps(q, _mm_loadu_ps(&job->sines[c]));
+            __m128 pz = _mm_add_ps(rz, _mm_mul_ps(h, d));
+            __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(M[0], px), _mm_mul_ps(M[1], py)), _mm_mul_ps(M[2], pz));
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(M[3], px), _mm_mul_ps(M[4], py)), _mm_mul_ps(M[5], pz));
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(M[6], px), _mm_mul_ps(M[7], py)), _mm_mul_ps(M[8], pz));
+            storeInterleaved3(&points[c*3], x, y, z);
+        }
+        for(; c < width; c++){
+            float p[3];
+            float h = elevationOrZero(data[c]) * 0.001f;
+            projectSample(row, job->sines[c], job->cosines[c], h, p);
+            const float *m = job->matrix;
+            points[c*3+0] = m[0]*p[0] + m[1]*p[1] + m[2]*p[2];
+            points[c*3+1] = m[3]*p[0] + m[4]*p[1] + m[5]*p[2];
+            points[c*3+2] = m[6]*p[0] + m[7]*p[1] + m[8]*p[2];
+        }
+    }
+}
+#endif
+
+static void projectGridWith(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double ydim, double xdim, int projection, double *center, float *points, int simd){
+    if(projection == DEM_PROJECTION_GRID){
+        gridPoints(data, width, height, points);
+        if(center != NULL)
+            center[0] = center[1] = center[2] = 0.0;
         return;
-    
+    }
+    double radians = M_PI / 180.0;
+    // origin, the same sample the flat grid is centered on
+    double lat0 = (latitude - height*.5*ydim) * radians;
+    double lon0 = (longitude + width*.5*xdim) * radians;
+    double N0 = WGS84_A / sqrt(1.0 - WGS84_E2*sin(lat0)*sin(lat0));
+    double x0 = N0 * cos(lat0);
+    double z0 = N0 * (1.0 - WGS84_E2) * sin(lat0);
+    if(center != NULL){
+        center[0] = x0 * cos(lon0);
+        center[1] = x0 * sin(lon0);
+        center[2] = z0;
+    }
+
+    struct demProjectionJob job;
+    job.data = data;
+    job.width = width;
+    job.points = points;
+    job.rows = (struct demProjectionRow*)malloc(sizeof(struct demProjectionRow) * height);
+    job.sines = (float*)malloc(sizeof(float) * width);
+    job.cosines = (float*)malloc(sizeof(float) * width);
+    for(unsigned int r = 0; r < height; r++){
+        double lat = (latitude - r*ydim) * radians;
+        double N = WGS84_A / sqrt(1.0 - WGS84_E2*sin(lat)*sin(lat));
+        job.rows[r].a = N * cos(lat);
+        job.rows[r].b = cos(lat);
+        job.rows[r].x = N * cos(lat) - x0;
+        job.rows[r].z = N * (1.0 - WGS84_E2) * sin(lat) - z0;
+        job.rows[r].d = sin(lat);
+    }
+    for(unsigned int c = 0; c < width; c++){
+        double dl = (longitude + c*xdim) * radians - lon0;
+        job.sines[c] = sin(dl);
+        job.cosines[c] = -2.0 * sin(dl*.5) * sin(dl*.5);   // cos(dl) - 1 without cancellation
+    }
+    float *M = job.matrix;
+    if(projection == DEM_PROJECTION_ECEF){
+        // undo the longitude rotation
+        M[0] = cos(lon0);  M[1] = -sin(lon0); M[2] = 0.0f;
+        M[3] = sin(lon0);  M[4] = cos(lon0);  M[5] = 0.0f;
+        M[6] = 0.0f;       M[7] = 0.0f;       M[8] = 1.0f;
+    }
+    else{
+        // east, north, up at the origin
+        M[0] = 0.0f;       M[1] = 1.0f;       M[2] = 0.0f;
+        M[3] = -sin(lat0); M[4] = 0.0f;       M[5] = cos(lat0);
+        M[6] = cos(lat0);  M[7] = 0.0f;       M[8] = sin(lat0);
+    }
+#ifdef __SSE2__
+    if(simd)
+        parallelRows(height, 64, projectSIMDKernel, &job);
+    else
+        projectScalarKernel(&job, 0, height);
+#else
+    if(simd)
+        parallelRows(height, 64, projectScalarKernel, &job);
+    else
+        projectScalarKernel(&job, 0, height);
+#endif
+    free(job.rows);
+    free(job.sines);
+    free(job.cosines);
+}
+
+void projectGrid(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double ydim, double xdim, int projection, double *center, float *points){
+    projectGridWith(data, width, height, latitude, longitude, ydim, xdim, projection, center, points, 1);
+}
+
+void projectGridScalar(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double ydim, double xdim, int projection, double *center, float *points){
+    projectGridWith(data, width, height, latitude, longitude, ydim, xdim, projection, center, points, 0);
+}
+
+struct demSurfaceNormalJob {
+    const float *points;
+    unsigned int width;
+    unsigned int height;
+    float sign;
+    float *normals;
+};
+
+static void surfaceNormalsKernel(void *context, unsigned int start, unsigned int end){
+    struct demSurfaceNormalJob *job = (struct demSurfaceNormalJob*)context;
+    unsigned int width = job->width;
+    const float *P = job->points;
+    for(unsigned int h = start; h < end; h++){
+        unsigned int up = (h > 0) ? h-1 : h;
+        unsigned int down = (h+1 < job->height) ? h+1 : h;
+        for(unsigned int w = 0; w < width; w++){
+            unsigned int left = (w > 0) ? w-1 : w;
+            unsigned int right = (w+1 < width) ? w+1 : w;
+            float u[3], v[3], n[3];
+            for(int i = 0; i < 3; i++){
+                u[i] = P[(h*width+right)*3+i] - P[(h*width+left)*3+i];
+                v[i] = P[(down*width+w)*3+i] - P[(up*width+w)*3+i];
+            }
+            n[0] = u[1]*v[2] - u[2]*v[1];
+            n[1] = u[2]*v[0] - u[0]*v[2];
+            n[2] = u[0]*v[1] - u[1]*v[0];
+            float length = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            float scale = (length > 0.0f) ? job->sign / length : 0.0f;
+            for(int i = 0; i < 3; i++)
+                job->normals[(h*width+w)*3+i] = n[i] * scale;
+        }
+    }
+}
+
+void surfaceNormals(float *points, unsigned int width, unsigned int height, int projection, float *normals){
+    // grid y runs with the rows (south), the projected frames have rows running north to south
+    // on a right handed surface, so the cross product of east and south points down
+    struct demSurfaceNormalJob job = { points, width, height, (projection == DEM_PROJECTION_GRID) ? 1.0f : -1.0f, normals };
+    parallelRows(height, 64, surfaceNormalsKernel, &job);
+}
+
+
+void elevationTrianglesProjected(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, int projection, double *center, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
     // load meta data from header
     struct demMeta meta = loadHeader(directory, filename);
-    
-    // convert lat/lon into column/row for plate
-    unsigned int row, column;
-    getByteColumnRowFromGeoLocation(meta, latitude, longitude, &column, &row);
-    
-    // shift center point to top left, and check boundaries
-    column -= width*.5;
-    row -= height*.5;
-    checkBoundaries(meta, &column, &row, &width, &height);
-    printf("Columns:(%d to %d)\nRows:(%d to %d)\n",column, column+width, row, row+height);
-    
-    // crop DEM and load it into memory
-    int16_t *data = cropDEMWithMeta(directory, filename, meta, column, row, width, height);
-    
-    // empty point cloud, (x, y, z)
-    unsigned int count = (width)*2*(height-1) * 3;
-    points = (float*)malloc(sizeof(float) * count);
-    int16_t elev;
-    for(int h = 0; h < height-1; h++){
-        for(int q = 0; q < width; q++){
-            int w;
-            if(h%2 == 0) w = q;
-            else         w = width-1-q;
-            points[(h*width+w)*6+0] = (w - width*.5);
-            points[(h*width+w)*6+1] = (h - height*.5);
-            elev = data[h*width+w];
-            if(elev == -9999)
-                points[(h*width+w)*6+2] = 0.0f;
-            else
-                points[(h*width+w)*6+2] = data[h*width+w];
+    unsigned int column, row;
+    int16_t *data = cropAroundGeoLocation(directory, filename, meta, latitude, longitude, &width, &height, &column, &row);
+    if(data == NULL)
+        return;
 
-            points[(h*width+w)*6+3] = (w - width*.5);
-            points[(h*width+w)*6+4] = ((h+1) - height*.5);
-            elev = data[(h+1)*width+w];
-            if(elev == -9999)
-                points[(h*width+w)*6+5] = 0.0f;
-            else
-                points[(h*width+w)*6+5] = data[(h+1)*width+w];
-        }
-    }
-    // calculate normals
-//    for(int i = 1; i < ((height-1)*width*2 - 1); i++){
-//        float Ux = points[i*3+0] - points[(i-1)*3+0];
-//        float Uy = points[i*3+1] - points[(i-1)*3+1];
-//        float Uz = points[i*3+2] - points[(i-1)*3+2];
-//        
-//        float Vx = points[(i+1)*3+0] - points[(i-1)*3+0];
-//        float Vy = points[(i+1)*3+1] - points[(i-1)*3+1];
-//        float Vz = points[(i+1)*3+2] - points[(i-1)*3+2];
-//        
-//        float Nx = Uy*Vz - Uz*Vy;
-//        float Ny = Uz*Vx - Ux*Vz;
-//        float Nz = Ux*Vy - Uy*Vx;
-//
-//        points[count+i*3+0] = Nx;
-//        points[count+i*3+1] = Ny;
-//        points[count+i*3+2] = Nz;
-//    }
-//        So for a triangle p1, p2, p3, if the vector U = p2 - p1 and the vector V = p3 - p1 then the normal N = U X V and can be calculated by:
-//            Nx = UyVz - UzVy
-//            Ny = UzVx - UxVz
-//            Nz = UxVy - UyVx
+    // ULXMAP, ULYMAP are the center of the top left sample
+    double topLatitude = meta.ulymap - row*meta.ydim;
+    double leftLongitude = meta.ulxmap + column*meta.xdim;
+    (*points) = (float*)malloc(sizeof(float) * width*height * 3);
+    projectGrid(data, width, height, topLatitude, leftLongitude, meta.ydim, meta.xdim, projection, center, *points);
+
+    if(normals != NULL){
+        (*normals) = (float*)malloc(sizeof(float) * width*height * 3);
+        surfaceNormals(*points, width, height, projection, *normals);
+    }
+
+    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * 2*(width-1)*(height-1) * 3);
+    *numIndices = gridTriangleIndices(width, height, *indices);
+
+    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
+    elevationColors(data, width*height, *colors);
+
+    *numPoints = height * width;
+    free(data);
+}
+
+
+// RESAMPLING
+//   separable: a horizontal pass over the source rows into float planes, then a vertical
+//   pass into the output. no-data samples carry no weight; an output sample is no-data
+//   when less than half of its filter footprint has data
+struct demFilterTable {
+    unsigned int taps;      // per output sample
+    uint32_t *index;        // [count * taps] source sample, clamped to the data
+    float *weights;         // [count * taps] normalized to sum to 1
+};
+
+// source coordinates: sample k is centered at k and covers [k-0.5, k+0.5]
+static void filterTable(int filter, double start, double span, unsigned int count, unsigned int size, struct demFilterTable *table){
+    double scale = span / count;
+    double radius = scale * .5;
+    if(filter == DEM_RESAMPLE_NEAREST) table->taps = 1;
+    else if(filter == DEM_RESAMPLE_BILINEAR) table->taps = 2;
+    else table->taps = (unsigned int)ceil(2.0*radius) + 1;
+    table->index = (uint32_t*)malloc(sizeof(uint32_t) * count * table->taps);
+    table->weights = (float*)calloc(count * table->taps, sizeof(float));
+    for(unsigned int i = 0; i < count; i++){
+        double center = start + (i + .5) * scale;
+        uint32_t *index = &table->index[i*table->taps];
+        float *weights = &table->weights[i*table->taps];
+        long first;
+        if(filter == DEM_RESAMPLE_NEAREST){
+            first = (long)floor(center + .5);
+            weights[0] = 1.0f;
+        }
+        else if(filter == DEM_RESAMPLE_BILINEAR){
+            first = (long)floor(center);
+            weights[0] = 1.0 - (center - first);
+            weights[1] = center - first;
+        }
+        else{
+            first = (long)floor(center - radius + .5);
+            double sum = 0.0;
+            for(unsigned int t = 0; t < table->taps; t++){
+                double k = first + t;
+                double overlap = fmin(k + .5, center + radius) - fmax(k - .5, center - radius);
+                if(overlap > 0.0){
+                    weights[t] = overlap;
+                    sum += overlap;
+                }
+            }
+            for(unsigned int t = 0; t < table->taps; t++)
+                weights[t] /= sum;
+        }
+        for(unsigned int t = 0; t < table->taps; t++){
+            long k = first + t;
+            if(k < 0) k = 0;
+            if(k > (long)size-1) k = size-1;
+            index[t] = k;
+        }
+    }
+}
+
+struct demResampleJob {
+    const int16_t *data;
+    unsigned int dataWidth;
+    unsigned int width;
+    unsigned int firstRow;      // source rows the vertical taps use
+    struct demFilterTable columns;
+    struct demFilterTable rows;
+    float *values;      // [dataHeight * width] weighted sum of valid samples
+    float *coverage;    // [dataHeight * width] sum of their weights
+    int16_t *output;
+};
+
+static void resampleRowsKernel(void *context, unsigned int start, unsigned int end){
+    struct demResampleJob *job = (struct demResampleJob*)context;
+    unsigned int taps = job->columns.taps;
+    for(unsigned int r = start + job->firstRow; r < end + job->firstRow; r++){
+        const int16_t *row = &job->data[r*job->dataWidth];
+        for(unsigned int i = 0; i < job->width; i++){
+            float value = 0.0f, coverage = 0.0f;
+            for(unsigned int t = 0; t < taps; t++){
+                int16_t sample = row[job->columns.index[i*taps+t]];
+                if(sample == DEM_NODATA) continue;
+                value += job->columns.weights[i*taps+t] * sample;
+                coverage += job->columns.weights[i*taps+t];
+            }
+            job->values[r*job->width+i] = value;
+            job->coverage[r*job->width+i] = coverage;
+        }
+    }
+}
+
+static void resampleColumnsScalarKernel(void *context, unsigned int start, unsigned int end){
+    struct demResampleJob *job = (struct demResampleJob*)context;
+    unsigned int taps = job->rows.taps, width = job->width;
+    for(unsigned int j = start; j < end; j++){
+        for(unsigned int i = 0; i < width; i++){
+            float value = 0.0f, coverage = 0.0f;
+            for(unsigned int t = 0; t < taps; t++){
+                uint32_t r = job->rows.index[j*taps+t];
+                value += job->rows.weights[j*taps+t] * job->values[r*width+i];
+                coverage += job->rows.weights[j*taps+t] * job->coverage[r*width+i];
+            }
+            job->output[j*width+i] = (coverage < 0.5f) ? DEM_NODATA : (int16_t)lrintf(value / coverage);
+        }
+    }
+}
+
+#ifdef __SSE2__
+// one output column of the horizontal pass for four source rows, one row per lane,
+// all through the same column taps. no-data lanes get a zero weight
+static inline void resampleColumn4(const int16_t *row, unsigned int dataWidth, const uint32_t *index, const float *weights, unsigned int taps, __m128 *value, __m128 *coverage){
+    __m128i nodata = _mm_set1_epi32(DEM_NODATA);
+    __m128 v = _mm_setzero_ps(), c = _mm_setzero_ps();
+    for(unsigned int t = 0; t < taps; t++){
+        const int16_t *sample = &row[index[t]];
+        __m128i s = _mm_setr_epi32(sample[0], sample[dataWidth], sample[2*dataWidth], sample[3*dataWidth]);
+        __m128 weight = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(s, nodata)), _mm_set1_ps(weights[t]));
+        v = _mm_add_ps(v, _mm_mul_ps(weight, _mm_cvtepi32_ps(s)));
+        c = _mm_add_ps(c, weight);
+    }
+    *value = v;
+    *coverage = c;
+}
+
+// four source rows at a time. four output columns (one vector down the rows each) are
+// transposed into four row vectors, so the planes keep the scalar layout
+static void resampleRowsSIMDKernel(void *context, unsigned int start, unsigned int end){
+    struct demResampleJob *job = (struct demResampleJob*)context;
+    unsigned int taps = job->columns.taps, width = job->width, dataWidth = job->dataWidth;
+    const uint32_t *index = job->columns.index;
+    const float *weights = job->columns.weights;
+    unsigned int r = start;
+    for(; r + 4 <= end; r += 4){
+        unsigned int source = r + job->firstRow;
+        const int16_t *row = &job->data[source*dataWidth];
+        float *values = &job->values[source*width];
+        float *coverage = &job->coverage[source*width];
+        unsigned int i = 0;
+        for(; i + 4 <= width; i += 4){
+            __m128 v0, v1, v2, v3, c0, c1, c2, c3;
+            resampleColumn4(row, dataWidth, &index[(i+0)*taps], &weights[(i+0)*taps], taps, &v0, &c0);
+            resampleColumn4(row, dataWidth, &index[(i+1)*taps], &weights[(i+1)*taps], taps, &v1, &c1);
+            resampleColumn4(row, dataWidth, &index[(i+2)*taps], &weights[(i+2)*taps], taps, &v2, &c2);
+            resampleColumn4(row, dataWidth, &index[(i+3)*taps], &weights[(i+3)*taps], taps, &v3, &c3);
+            _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_storeu_ps(&values[i], v0);
+            _mm_storeu_ps(&values[width+i], v1);
+            _mm_storeu_ps(&values[2*width+i], v2);
+            _mm_storeu_ps(&values[3*width+i], v3);
+            _mm_storeu_ps(&coverage[i], c0);
+            _mm_storeu_ps(&coverage[width+i], c1);
+            _mm_storeu_ps(&coverage[2*width+i], c2);
+            _mm_storeu_ps(&coverage[3*width+i], c3);
+        }
+        for(; i < width; i++){
+            __m128 v, c;
+            float lanes[8];
+            resampleColumn4(row, dataWidth, &index[i*taps], &weights[i*taps], taps, &v, &c);
+            _mm_storeu_ps(&lanes[0], v);
+            _mm_storeu_ps(&lanes[4], c);
+            for(unsigned int k = 0; k < 4; k++){
+                values[k*width+i] = lanes[k];
+                coverage[k*width+i] = lanes[4+k];
+            }
+        }
+    }
+    if(r < end)
+        resampleRowsKernel(context, r, end);
+}
+
+static void resampleColumnsSIMDKernel(void *context, unsigned int start, unsigned int end){
+    struct demResampleJob *job = (struct demResampleJob*)context;
+    unsigned int taps = job->rows.taps, width = job->width;
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128i nodata = _mm_set1_epi32(DEM_NODATA);
+    for(unsigned int j = start; j < end; j++){
+        unsigned int i = 0;
+        for(; i + 4 <= width; i += 4){
+            __m128 value = _mm_setzero_ps(), coverage = _mm_setzero_ps();
+            for(unsigned int t = 0; t < taps; t++){
+                uint32_t r = job->rows.index[j*taps+t];
+                __m128 weight = _mm_set1_ps(job->rows.weights[j*taps+t]);
+                value = _mm_add_ps(value, _mm_mul_ps(weight, _mm_loadu_ps(&job->values[r*width+i])));
+                coverage = _mm_add_ps(coverage, _mm_mul_ps(weight, _mm_loadu_ps(&job->coverage[r*width+i])));
+            }
+            __m128 empty = _mm_cmplt_ps(coverage, half);
+            // empty lanes divide by 1 instead of 0, then become no-data
+            __m128 divisor = _mm_or_ps(_mm_andnot_ps(empty, coverage), _mm_and_ps(empty, _mm_set1_ps(1.0f)));
+            __m128i elevation = _mm_cvtps_epi32(_mm_div_ps(value, divisor));
+            __m128i mask = _mm_castps_si128(empty);
+            elevation = _mm_or_si128(_mm_andnot_si128(mask, elevation), _mm_and_si128(mask, nodata));
+            _mm_storel_epi64((__m128i*)&job->output[j*width+i], _mm_packs_epi32(elevation, elevation));
+        }
+        for(; i < width; i++){
+            float value = 0.0f, coverage = 0.0f;
+            for(unsigned int t = 0; t < taps; t++){
+                uint32_t r = job->rows.index[j*taps+t];
+                value += job->rows.weights[j*taps+t] * job->values[r*width+i];
+                coverage += job->rows.weights[j*taps+t] * job->coverage[r*width+i];
+            }
+            job->output[j*width+i] = (coverage < 0.5f) ? DEM_NODATA : (int16_t)lrintf(value / coverage);
+        }
+    }
+}
+#endif
+
+static int16_t* resampleDEMWith(int16_t *data, unsigned int dataWidth, unsigned int dataHeight, double x, double y, double spanWidth, double spanHeight, unsigned int width, unsigned int height, int filter, int simd){
+    if(!width || !height || !dataWidth || !dataHeight)
+        return NULL;
+    struct demResampleJob job;
+    job.data = data;
+    job.dataWidth = dataWidth;
+    job.width = width;
+    filterTable(filter, x - .5, spanWidth, width, dataWidth, &job.columns);
+    filterTable(filter, y - .5, spanHeight, height, dataHeight, &job.rows);
+    // the horizontal pass only runs over rows the vertical pass reads
+    unsigned int lastRow = 0;
+    job.firstRow = dataHeight;
+    for(unsigned int i = 0; i < height * job.rows.taps; i++){
+        if(job.rows.index[i] < job.firstRow) job.firstRow = job.rows.index[i];
+        if(job.rows.index[i] > lastRow) lastRow = job.rows.index[i];
+    }
+    unsigned int usedRows = lastRow - job.firstRow + 1;
+    job.values = (float*)malloc(sizeof(float) * dataHeight * width);
+    job.coverage = (float*)malloc(sizeof(float) * dataHeight * width);
+    job.output = (int16_t*)malloc(sizeof(int16_t) * width * height);
+    if(simd){
+#ifdef __SSE2__
+        parallelRows(usedRows, 64, resampleRowsSIMDKernel, &job);
+        parallelRows(height, 64, resampleColumnsSIMDKernel, &job);
+#else
+        parallelRows(usedRows, 64, resampleRowsKernel, &job);
+        parallelRows(height, 64, resampleColumnsScalarKernel, &job);
+#endif
+    }
+    else{
+        resampleRowsKernel(&job, 0, usedRows);
+        resampleColumnsScalarKernel(&job, 0, height);
+    }
+    free(job.columns.index);
+    free(job.columns.weights);
+    free(job.rows.index);
+    free(job.rows.weights);
+    free(job.values);
+    free(job.coverage);
+    return job.output;
+}
+
+int16_t* resampleDEM(int16_t *data, unsigned int dataWidth, unsigned int dataHeight, double x, double y, double spanWidth, double spanHeight, unsigned int width, unsigned int height, int filter){
+    return resampleDEMWith(data, dataWidth, dataHeight, x, y, spanWidth, spanHeight, width, height, filter, 1);
+}
+
+int16_t* resampleDEMScalar(int16_t *data, unsigned int dataWidth, unsigned int dataHeight, double x, double y, double spanWidth, double spanHeight, unsigned int width, unsigned int height, int filter){
+    return resampleDEMWith(data, dataWidth, dataHeight, x, y, spanWidth, spanHeight, width, height, filter, 0);
+}
 
+
+int16_t* cropDEMResampled(char *directory, char *filename, struct demMeta meta, float north, float west, float south, float east, unsigned int width, unsigned int height, int filter){
+    if(!width || !height || north <= south || east <= west)
+        return NULL;
+    // rectangle edges in sample coordinates of the tile, sample centers are whole numbers
+    double left = (west - meta.ulxmap) / meta.xdim;
+    double right = (east - meta.ulxmap) / meta.xdim;
+    double top = (meta.ulymap - north) / meta.ydim;
+    double bottom = (meta.ulymap - south) / meta.ydim;
+    if(left < -.5 || top < -.5 || right > meta.ncols-.5 || bottom > meta.nrows-.5)
+        printf("\nWARNING: rectangle lies partly outside data, repeating the edge samples\n");
+
+    // crop with a one sample margin for the filter taps
+    long x0 = (long)floor(left) - 1, x1 = (long)ceil(right) + 1;
+    long y0 = (long)floor(top) - 1, y1 = (long)ceil(bottom) + 1;
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > (long)meta.ncols-1) x1 = meta.ncols-1;
+    if(y1 > (long)meta.nrows-1) y1 = meta.nrows-1;
+    if(x1 < x0 || y1 < y0){
+        printf("\nEXCEPTION: rectangle lies outside data\n");
+        return NULL;
+    }
+    unsigned int cropWidth = x1 - x0 + 1, cropHeight = y1 - y0 + 1;
+    int16_t *crop = cropDEMWithMeta(directory, filename, meta, x0, y0, cropWidth, cropHeight);
+    int16_t *resampled = resampleDEM(crop, cropWidth, cropHeight, left - x0 + .5, top - y0 + .5, right - left, bottom - top, width, height, filter);
+    free(crop);
+    return resampled;
+}
+
+
+void elevationTrianglesResampled(char *directory, char *filename, float north, float west, float south, float east, unsigned int width, unsigned int height, int filter, int projection, double *center, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
+    // load meta data from header
+    struct demMeta meta = loadHeader(directory, filename);
+    int16_t *data = cropDEMResampled(directory, filename, meta, north, west, south, east, width, height, filter);
+    if(data == NULL)
+        return;
+
+    // output samples are centered in their cells
+    double ydim = (double)(north - south) / height;
+    double xdim = (double)(east - west) / width;
+    (*points) = (float*)malloc(sizeof(float) * width*height * 3);
+    projectGrid(data, width, height, north - ydim*.5, west + xdim*.5, ydim, xdim, projection, center, *points);
+
+    if(normals != NULL){
+        (*normals) = (float*)malloc(sizeof(float) * width*height * 3);
+        surfaceNormals(*points, width, height, projection, *normals);
+    }
+
+    (*indices) = (uint32_t*)malloc(sizeof(uint32_t) * 2*(width-1)*(height-1) * 3);
+    *numIndices = gridTriangleIndices(width, height, *indices);
+
+    (*colors) = (float*)malloc(sizeof(float) * width*height * 3);
+    elevationColors(data, width*height, *colors);
+
+    *numPoints = height * width;
+    free(data);
 }
 
 
@@ -1,6 +1,26 @@
 #ifndef GISOSX_DEM_h
 #define GISOSX_DEM_h
 
+#define DEM_NODATA -9999               // ocean, in GTOPO30 tiles
+#define DEM_METERS_PER_DEGREE 111195.0 // along a meridian, mean earth radius 6371 km
+#define DEM_MAX_THREADS 64
+#define DEM_RESTART_INDEX 0xFFFFFFFF   // primitive restart, between triangle strips
+#define DEM_WATER_PLANE_DEPTH -1.0f    // meters, water plane under the coastline (lower if land in the crop is lower)
+
+// projections for elevationTrianglesProjected
+#define DEM_PROJECTION_GRID 0          // cell offsets, same as elevationTriangles (z in meters)
+#define DEM_PROJECTION_TANGENT 1       // km, east north up on the plane tangent at the center
+#define DEM_PROJECTION_ECEF 2          // km, earth-centered earth-fixed axes, origin at the center
+
+// filters for resampling
+#define DEM_RESAMPLE_NEAREST 0
+#define DEM_RESAMPLE_BOX 1             // area average, for shrinking
+#define DEM_RESAMPLE_BILINEAR 2        // for enlarging
+
+// ocean modes for elevationTrianglesCulled
+#define DEM_OCEAN_KEEP 0               // every quad, same as elevationTriangles
+#define DEM_OCEAN_PLANE 1              // all-ocean quads replaced by one water plane under the rectangle
+#define DEM_OCEAN_CULL 2               // all-ocean quads left out
 
 // OPENGL MESH BUILDER
 // --------------------------------------------------
@@ -20,7 +40,44 @@ void elevationPointCloud(char *directory, char *filename, float latitude, float
 
 void elevationTriangles(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
 
-void elevationTriangleStrip(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float *points, float *colors);
+// NORMALS
+//    same as above, also mallocs per-point normals into "normals" (size: width * height * 3)
+//    normals are unit length in the points' coordinate space. pass NULL to skip them
+void elevationPointCloudWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, float **colors, unsigned int *numPoints);
+
+void elevationTrianglesWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
+
+// OCEAN CULLING
+//    same as elevationTrianglesWithNormals, but quads with no data at all four corners (ocean)
+//    are handled by "ocean" (DEM_OCEAN_KEEP, DEM_OCEAN_PLANE, DEM_OCEAN_CULL).
+//    the water plane sits at DEM_WATER_PLANE_DEPTH, or 1 m under the lowest land sample if that is lower
+//    points no triangle uses are removed, so numPoints can be smaller than width * height
+//    numCulled: how many grid triangles were dropped
+void elevationTrianglesCulled(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, int ocean, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices, unsigned int *numCulled);
+
+// PROJECTION
+//    same as elevationTrianglesWithNormals with true distances on the WGS84 ellipsoid, in km
+//    positions are relative to the center of the rectangle (at sea level), which is written
+//    to "center" as double precision ECEF (x, y, z) in km. add it back to place the mesh on a globe
+//    the points and colors also work as a point cloud, in the same order as elevationPointCloud
+void elevationTrianglesProjected(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, int projection, double *center, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
+
+// RESAMPLING
+//    a width x height mesh over any lat/lon rectangle (edges in degrees), whatever the tile's
+//    resolution: a fixed vertex budget for any region. filter: DEM_RESAMPLE_NEAREST, _BOX, _BILINEAR
+//    with DEM_PROJECTION_GRID 1 unit is one output cell, otherwise same as elevationTrianglesProjected
+void elevationTrianglesResampled(char *directory, char *filename, float north, float west, float south, float east, unsigned int width, unsigned int height, int filter, int projection, double *center, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
+
+// HILLSHADE
+//    mallocs a grayscale raster (0-255) into "shade" with size of width*height, row 0 is north
+//    light source azimuth in degrees clockwise from north, altitude in degrees above horizon
+//    (the cartographic default is 315, 45)
+void elevationHillshade(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float azimuth, float altitude, unsigned char **shade);
+
+// TRIANGLE STRIPS
+//    same points and colors as elevationTriangles, indices are one strip per row joined by DEM_RESTART_INDEX
+//    rows alternate direction (serpentine) so each strip starts beside the last one
+void elevationTriangleStrip(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
 
 
 
@@ -35,6 +92,15 @@ void elevationTriangleStrip(char *directory, char *filename, float latitude, flo
 // (double)			xdim:		degrees per step along X (degrees longitude)
 // (double)			ydim:		degrees per step along Y (degrees latitude)
 
+struct demMeta {
+    unsigned int nrows;
+    unsigned int ncols;
+    double ulxmap;
+    double ulymap;
+    double xdim;
+    double ydim;
+};
+
 // loads data from .HDR file (packaged with .DEM files from USGS)
 struct demMeta loadHeader(char *directory, char *filename);
 
@@ -46,6 +112,16 @@ int16_t* cropDEM(char *directory, char *filename, unsigned int x, unsigned int y
 //   same as above, if you already have the DEM header loaded into a demMeta struct
 int16_t* cropDEMWithMeta(char *directory, char *filename, struct demMeta meta, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
 
+// RESAMPLING DEM FILES
+//   returns a width x height grid covering the lat/lon rectangle (edges in degrees)
+//   no-data where less than half the filter footprint has data. NULL if nothing to crop
+int16_t* cropDEMResampled(char *directory, char *filename, struct demMeta meta, float north, float west, float south, float east, unsigned int width, unsigned int height, int filter);
+//   same, on data already in memory. the region starts at x, y and is spanWidth x spanHeight,
+//   in samples from the top left edge of the data (sample k covers k to k+1). mallocs the result
+//   separable, SIMD (SSE2) and multithreaded. *Scalar is the single threaded reference
+int16_t* resampleDEM(int16_t *data, unsigned int dataWidth, unsigned int dataHeight, double x, double y, double spanWidth, double spanHeight, unsigned int width, unsigned int height, int filter);
+int16_t* resampleDEMScalar(int16_t *data, unsigned int dataWidth, unsigned int dataHeight, double x, double y, double spanWidth, double spanHeight, unsigned int width, unsigned int height, int filter);
+
 // LAT LONG -> BYTE CONVERSION
 //   using location information found in header file,
 //   returns index of precise byte for a latitude, longitude
@@ -60,4 +136,53 @@ unsigned long getByteOffsetFromGeoLocation(struct demMeta meta, float latitude,
 //   which still fits inside .DEM boundaries 
 void checkBoundaries(struct demMeta meta, unsigned int *x, unsigned int *y, unsigned int *width, unsigned int *height);
 
+// NORMALS AND HILLSHADE FROM CROPPED DATA
+//   central differences over the grid, one-sided along the edges. no-data counts as sea level
+//   xSpacing, ySpacing: distance between neighboring samples, in the same unit as elevation
+//   normals size: width * height * 3, shade size: width * height
+//   SIMD (SSE2) and multithreaded. the *Scalar versions are the single threaded reference
+void elevationNormals(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float *normals);
+void elevationNormalsScalar(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float *normals);
+void hillshade(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float azimuth, float altitude, unsigned char *shade);
+void hillshadeScalar(int16_t *data, unsigned int width, unsigned int height, float xSpacing, float ySpacing, float azimuth, float altitude, unsigned char *shade);
+
+// PROJECTING CROPPED DATA
+//   latitude, longitude: location of sample (0,0), ydim, xdim: degrees per row, column
+//   trig and everything in double precision is done once per row and per column,
+//   the per sample pass is SIMD (SSE2) and multithreaded. *Scalar is the single threaded reference
+//   points size: width * height * 3, center: double[3] or NULL
+void projectGrid(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double ydim, double xdim, int projection, double *center, float *points);
+void projectGridScalar(int16_t *data, unsigned int width, unsigned int height, double latitude, double longitude, double ydim, double xdim, int projection, double *center, float *points);
+//   normals of any projected grid, cross product of central differences, pointing up
+void surfaceNormals(float *points, unsigned int width, unsigned int height, int projection, float *normals);
+
+// GRID INDICES
+//   index buffers for a width x height grid of points, returns number of indices written
+//   triangles: 6 * (width-1) * (height-1), row major, the layout used by elevationTriangles
+//   strips: (2 * width + 1) * (height-1) - 1, the layout used by elevationTriangleStrip
+unsigned int gridTriangleIndices(unsigned int width, unsigned int height, uint32_t *indices);
+unsigned int gridTriangleStripIndices(unsigned int width, unsigned int height, uint32_t *indices);
+//   same as gridTriangleIndices, skipping quads with DEM_NODATA at all four corners
+unsigned int gridTriangleIndicesCulled(int16_t *data, unsigned int width, unsigned int height, uint32_t *indices);
+//   removes vertices no index refers to and renumbers the indices (restart indices kept)
+//   streams: per-vertex (x,y,z) arrays compacted in place, NULL entries are skipped
+//   returns the new number of vertices
+unsigned int compactVertices(uint32_t *indices, unsigned int numIndices, unsigned int numPoints, float **streams, unsigned int numStreams);
+
+// VERTEX CACHE
+//   average cache miss ratio (ACMR): vertices transformed per triangle drawn, through a FIFO
+//   cache of cacheSize entries. 0.5 is ideal for a grid, 3.0 means no reuse at all
+//   strip: 0 for GL_TRIANGLES, 1 for GL_TRIANGLE_STRIP with DEM_RESTART_INDEX
+float averageCacheMissRatio(uint32_t *indices, unsigned int numIndices, unsigned int cacheSize, int strip);
+//   reorders GL_TRIANGLES in place for a post-transform cache of cacheSize (Tipsify)
+//   winding of each triangle is kept. 16 to 32 fits most hardware
+void optimizeVertexCache(uint32_t *indices, unsigned int numIndices, unsigned int numPoints, unsigned int cacheSize);
+
+// MULTITHREADING
+//   number of worker threads (online cores, at most DEM_MAX_THREADS)
+unsigned int demThreadCount();
+//   splits rows [0, count) into one band per thread, calls kernel(context, start, end) on each
+//   jobs smaller than 2 * minRowsPerThread run on the calling thread
+void parallelRows(unsigned int count, unsigned int minRowsPerThread, void (*kernel)(void *context, unsigned int start, unsigned int end), void *context);
+
 #endif
@@ -0,0 +1,226 @@
+// client for the demd elevation service, see demclient.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "demclient.h"
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0   // no such flag on OS X, a dead daemon raises SIGPIPE there
+#endif
+
+static __thread int demdConnection = -1;
+
+static int demdConnect(){
+    char *path = getenv("DEMD_SOCKET");
+    if(path == NULL)
+        path = DEMD_SOCKET;
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path)-1);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(connection < 0)
+        return -1;
+    if(connect(connection, (struct sockaddr*)&address, sizeof(address)) < 0){
+        printf("\nEXCEPTION: NO ELEVATION SERVICE AT (%s)\n", path);
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+void demdDisconnect(){
+    if(demdConnection >= 0)
+        close(demdConnection);
+    demdConnection = -1;
+}
+
+// the response, and the shared memory file descriptor that rides along with its first byte
+static int receiveResponse(int connection, struct demdResponse *response, int *memory){
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = { response, sizeof(*response) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(connection, &message, 0);
+    if(received <= 0)
+        return -1;
+    *memory = -1;
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if(header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        memcpy(memory, CMSG_DATA(header), sizeof(int));
+
+    // stream socket, the rest of the struct can arrive separately
+    while(received < sizeof(*response)){
+        ssize_t more = recv(connection, (char*)response + received, sizeof(*response) - received, 0);
+        if(more <= 0){
+            if(*memory >= 0)
+                close(*memory);
+            return -1;
+        }
+        received += more;
+    }
+    return 0;
+}
+
+int demdRoundTrip(struct demdRequest *request, struct demdResponse *response, unsigned char **memory){
+    memset(response, 0, sizeof(*response));
+    if(demdConnection < 0)
+        demdConnection = demdConnect();
+    if(demdConnection < 0)
+        return response->status = DEMD_ERROR_CONNECTION;
+
+    int shared;
+    if(send(demdConnection, request, sizeof(*request), MSG_NOSIGNAL) != sizeof(*request)
+    || receiveResponse(demdConnection, response, &shared)){
+        printf("\nEXCEPTION: LOST CONNECTION TO ELEVATION SERVICE\n");
+        demdDisconnect();
+        memset(response, 0, sizeof(*response));
+        return response->status = DEMD_ERROR_CONNECTION;
+    }
+    if(shared < 0)
+        return response->status;
+
+    // map the daemon's result in place. the mapping holds on to the memory after the descriptor is closed
+    void *mapping = MAP_FAILED;
+    if(response->status == DEMD_OK && response->size > DEMD_HEADER_BYTES)
+        mapping = mmap(NULL, response->size, PROT_READ | PROT_WRITE, MAP_SHARED, shared, 0);
+    close(shared);
+    if(mapping == MAP_FAILED){
+        if(response->status == DEMD_OK)
+            response->status = DEMD_ERROR_MEMORY;
+        return response->status;
+    }
+    *memory = (unsigned char*)mapping;
+    return DEMD_OK;
+}
+
+void demdFree(void *array){
+    if(array == NULL)
+        return;
+    unsigned char *mapping = (unsigned char*)array - DEMD_HEADER_BYTES;
+    munmap(mapping, *(uint64_t*)mapping);
+}
+
+static int fillRequest(struct demdRequest *request, uint32_t op, char *directory, char *filename){
+    memset(request, 0, sizeof(*request));
+    request->op = op;
+    // room for the extension, like dem.c's path buffers
+    if(strlen(directory) + strlen(filename) + 5 > DEMD_PATH_LENGTH){
+        printf("\nEXCEPTION: PATH (%s%s) TOO LONG\n", directory, filename);
+        return 0;
+    }
+    strcpy(request->directory, directory);
+    strcpy(request->filename, filename);
+    return 1;
+}
+
+static void printStatus(int status, char *directory, char *filename){
+    if(status == DEMD_ERROR_FILE)
+        printf("\nEXCEPTION: FILE (%s%s) DOESN'T EXIST\n", directory, filename);
+    else if(status == DEMD_ERROR_BOUNDS)
+        printf("\nEXCEPTION: outside the boundaries of (%s%s)\n", directory, filename);
+    else if(status == DEMD_ERROR_REQUEST)
+        printf("\nEXCEPTION: elevation service rejected the request\n");
+    else if(status == DEMD_ERROR_MEMORY)
+        printf("\nEXCEPTION: elevation service out of memory\n");
+}
+
+struct demMeta demdLoadHeader(char *directory, char *filename){
+    struct demdRequest request;
+    struct demdResponse response;
+    unsigned char *memory;
+    if(fillRequest(&request, DEMD_HEADER, directory, filename))
+        printStatus(demdRoundTrip(&request, &response, &memory), directory, filename);
+    else
+        memset(&response, 0, sizeof(response));
+    return response.meta;
+}
+
+int16_t* demdCropDEM(char *directory, char *filename, unsigned int x, unsigned int y, unsigned int width, unsigned int height){
+    struct demdRequest request;
+    struct demdResponse response;
+    unsigned char *memory;
+    if(!fillRequest(&request, DEMD_CROP, directory, filename))
+        return NULL;
+    request.x = x;
+    request.y = y;
+    request.width = width;
+    request.height = height;
+    int status = demdRoundTrip(&request, &response, &memory);
+    printStatus(status, directory, filename);
+    if(status != DEMD_OK || !response.size)
+        return NULL;
+    return (int16_t*)(memory + response.data);
+}
+
+int16_t demdElevationAt(char *directory, char *filename, float latitude, float longitude){
+    struct demdRequest request;
+    struct demdResponse response;
+    unsigned char *memory;
+    if(!fillRequest(&request, DEMD_SAMPLE, directory, filename))
+        return DEM_NODATA;
+    request.latitude = latitude;
+    request.longitude = longitude;
+    int status = demdRoundTrip(&request, &response, &memory);
+    printStatus(status, directory, filename);
+    if(status != DEMD_OK)
+        return DEM_NODATA;
+    return response.elevation;
+}
+
+// point clouds and triangles are the same request, without or with indices
+static void demdMesh(uint32_t op, char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
+    struct demdRequest request;
+    struct demdResponse response;
+    unsigned char *memory;
+    if(!fillRequest(&request, op, directory, filename))
+        return;
+    request.latitude = latitude;
+    request.longitude = longitude;
+    request.width = width;
+    request.height = height;
+    request.normals = (normals != NULL);
+    int status = demdRoundTrip(&request, &response, &memory);
+    printStatus(status, directory, filename);
+    if(status != DEMD_OK || !response.size)
+        return;
+
+    (*points) = (float*)(memory + response.points);
+    if(normals != NULL)
+        (*normals) = (float*)(memory + response.normals);
+    if(indices != NULL)
+        (*indices) = (uint32_t*)(memory + response.indices);
+    (*colors) = (float*)(memory + response.colors);
+    *numPoints = response.numPoints;
+    if(numIndices != NULL)
+        *numIndices = response.numIndices;
+}
+
+void demdElevationPointCloudWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, float **colors, unsigned int *numPoints){
+    demdMesh(DEMD_POINT_CLOUD, directory, filename, latitude, longitude, width, height, points, normals, NULL, colors, numPoints, NULL);
+}
+
+void demdElevationPointCloud(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **colors, unsigned int *numPoints){
+    demdMesh(DEMD_POINT_CLOUD, directory, filename, latitude, longitude, width, height, points, NULL, NULL, colors, numPoints, NULL);
+}
+
+void demdElevationTrianglesWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
+    demdMesh(DEMD_TRIANGLES, directory, filename, latitude, longitude, width, height, points, normals, indices, colors, numPoints, numIndices);
+}
+
+void demdElevationTriangles(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices){
+    demdMesh(DEMD_TRIANGLES, directory, filename, latitude, longitude, width, height, points, NULL, indices, colors, numPoints, numIndices);
+}
@@ -0,0 +1,101 @@
+#ifndef GISOSX_DEMCLIENT_h
+#define GISOSX_DEMCLIENT_h
+
+#include "dem.h"
+
+
+// ELEVATION SERVICE
+// --------------------------------------------------
+// demd (demd.c) is a long running process that loads each tile once, keeps it decoded in
+// memory and answers every process on the machine over a Unix domain socket.
+// this client library mirrors the dem.h entry points, with a demd prefix
+//
+// SHARED MEMORY
+//    crops and meshes are written by the daemon straight into shared memory which the client
+//    maps, nothing large goes through the socket. release them with demdFree, not free().
+//    mesh arrays share one mapping: demdFree(points) releases points, normals, indices and colors
+//
+// CONNECTIONS
+//    one connection per thread, opened on the first call. socket path is DEMD_SOCKET,
+//    or the DEMD_SOCKET environment variable if it is set
+//
+// ERRORS
+//    same as dem.c: prints an EXCEPTION and leaves the outputs untouched
+
+#define DEMD_SOCKET "/tmp/demd.sock"
+#define DEMD_PATH_LENGTH 128      // directory + filename + extension, same limit as dem.c
+#define DEMD_HEADER_BYTES 64      // shared memory starts with the mapping size, arrays follow
+
+// requests
+#define DEMD_HEADER 1
+#define DEMD_CROP 2
+#define DEMD_SAMPLE 3
+#define DEMD_POINT_CLOUD 4
+#define DEMD_TRIANGLES 5
+
+// response status
+#define DEMD_OK 0
+#define DEMD_ERROR_FILE 1         // tile not found, or .DEM size doesn't match the .HDR
+#define DEMD_ERROR_BOUNDS 2       // location or rectangle outside the tile
+#define DEMD_ERROR_REQUEST 3      // unknown request, path too long
+#define DEMD_ERROR_MEMORY 4       // daemon couldn't allocate
+#define DEMD_ERROR_CONNECTION 5   // client side: no daemon, or it went away
+
+struct demdRequest {
+    uint32_t op;
+    uint32_t normals;                    // meshes: 1 to include normals
+    char directory[DEMD_PATH_LENGTH];
+    char filename[DEMD_PATH_LENGTH];
+    float latitude;                      // sample: location, meshes: center of the rectangle
+    float longitude;
+    uint32_t x;                          // crop: top left corner
+    uint32_t y;
+    uint32_t width;                      // crop, meshes
+    uint32_t height;
+};
+
+struct demdResponse {
+    int32_t status;
+    int16_t elevation;                   // sample
+    struct demMeta meta;                 // every request
+    uint32_t width;                      // crop, meshes: after checkBoundaries
+    uint32_t height;
+    uint32_t numPoints;
+    uint32_t numIndices;
+    uint64_t size;                       // bytes of shared memory passed with the response, 0 if none
+    uint64_t data;                       // byte offsets of each array in the shared memory, 0 if absent
+    uint64_t points;
+    uint64_t normals;
+    uint64_t indices;
+    uint64_t colors;
+};
+
+// same as loadHeader, cached by the daemon
+struct demMeta demdLoadHeader(char *directory, char *filename);
+
+// same as cropDEM. edges are checked, a rectangle past the tile is an error
+int16_t* demdCropDEM(char *directory, char *filename, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+// POINT SAMPLE
+//   elevation of the cell containing lat/lon, DEM_NODATA on error (or ocean)
+int16_t demdElevationAt(char *directory, char *filename, float latitude, float longitude);
+
+// same as the mesh builders in dem.h
+void demdElevationPointCloud(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float** points, float** colors, unsigned int *numPoints);
+void demdElevationTriangles(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
+void demdElevationPointCloudWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, float **colors, unsigned int *numPoints);
+void demdElevationTrianglesWithNormals(char *directory, char *filename, float latitude, float longitude, unsigned int width, unsigned int height, float **points, float **normals, uint32_t **indices, float **colors, unsigned int *numPoints, unsigned int *numIndices);
+
+// unmaps a crop, or a mesh by its points
+void demdFree(void *array);
+
+// closes this thread's connection, the next call opens a new one
+void demdDisconnect();
+
+// LOW LEVEL
+//   one round trip. on DEMD_OK with response->size, *memory is the mapped shared memory and
+//   the arrays are at the response's offsets, release with demdFree(*memory + DEMD_HEADER_BYTES)
+//   returns response->status
+int demdRoundTrip(struct demdRequest *request, struct demdResponse *response, unsigned char **memory);
+
+#endif
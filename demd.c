@@ -0,0 +1,392 @@
+// demd: local elevation service, one decoded copy of each tile for every process on the machine
+//   usage: ./demd [cache megabytes] [socket path]
+//     cache megabytes: decoded tiles kept in memory, least recently used go first (default 1024)
+//     socket path: default DEMD_SOCKET, or the DEMD_SOCKET environment variable
+//
+// requests and responses are the fixed size structs in demclient.h. crops and meshes are
+// built directly in a shared memory file which is passed to the client with the response
+// (SCM_RIGHTS), the client maps it and uses the arrays where they are
+//
+
+#define _GNU_SOURCE   // memfd_create
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "dem.c"
+#include "demclient.h"
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+// TILE CACHE
+//   one entry per .DEM file, the whole tile decoded to native byte order on first use.
+//   users counts requests reading data right now, entries in use are never evicted
+struct demdTile {
+    char directory[DEMD_PATH_LENGTH];
+    char filename[DEMD_PATH_LENGTH];
+    struct demMeta meta;
+    int16_t *data;
+    int status;            // DEMD_OK once loaded
+    int loading;
+    unsigned int users;
+    unsigned long lastUsed;
+    struct demdTile *next;
+};
+
+static struct demdTile *tiles = NULL;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cacheLoaded = PTHREAD_COND_INITIALIZER;
+static unsigned long cacheBytes = 0;
+static unsigned long cacheLimit = 1024ul << 20;
+static unsigned long cacheClock = 0;
+
+static unsigned long tileBytes(struct demdTile *tile){
+    return (unsigned long)tile->meta.ncols * tile->meta.nrows * sizeof(int16_t);
+}
+
+// reads the header and the whole .DEM, swapping big endian to native
+static int loadTile(struct demdTile *tile){
+    char path[DEMD_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s%s.HDR", tile->directory, tile->filename);
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+        return DEMD_ERROR_FILE;
+    fclose(file);
+    tile->meta = loadHeader(tile->directory, tile->filename);
+
+    snprintf(path, sizeof(path), "%s%s.DEM", tile->directory, tile->filename);
+    file = fopen(path, "r");
+    if(file == NULL)
+        return DEMD_ERROR_FILE;
+    struct stat info;
+    if(fstat(fileno(file), &info) || !tile->meta.ncols || !tile->meta.nrows || (unsigned long)info.st_size != tileBytes(tile)){
+        printf("\nEXCEPTION: (%s) is not %u x %u samples\n", path, tile->meta.ncols, tile->meta.nrows);
+        fclose(file);
+        return DEMD_ERROR_FILE;
+    }
+    tile->data = (int16_t*)malloc(tileBytes(tile));
+    if(tile->data == NULL){
+        fclose(file);
+        return DEMD_ERROR_MEMORY;
+    }
+    unsigned long count = (unsigned long)tile->meta.ncols * tile->meta.nrows;
+    unsigned long read = fread(tile->data, sizeof(int16_t), count, file);
+    fclose(file);
+    if(read != count){
+        free(tile->data);
+        tile->data = NULL;
+        return DEMD_ERROR_FILE;
+    }
+    uint16_t *swap = (uint16_t*)tile->data;
+    for(unsigned long i = 0; i < count; i++)
+        swap[i] = (swap[i]>>8) | (swap[i]<<8);
+    return DEMD_OK;
+}
+
+// drops least recently used tiles nobody is reading until the cache fits. call with cacheLock held
+static void evictTiles(){
+    while(cacheBytes > cacheLimit){
+        struct demdTile **oldest = NULL;
+        for(struct demdTile **t = &tiles; *t != NULL; t = &(*t)->next)
+            if(!(*t)->users && !(*t)->loading && (oldest == NULL || (*t)->lastUsed < (*oldest)->lastUsed))
+                oldest = t;
+        if(oldest == NULL)
+            return;
+        struct demdTile *tile = *oldest;
+        *oldest = tile->next;
+        cacheBytes -= tileBytes(tile);
+        printf("Evicted %s%s\n", tile->directory, tile->filename);
+        free(tile->data);
+        free(tile);
+    }
+}
+
+// finds or loads a tile and marks it in use, *status says whether it has data. release it either way
+static struct demdTile* acquireTile(char *directory, char *filename, int *status){
+    pthread_mutex_lock(&cacheLock);
+    struct demdTile *tile = tiles;
+    while(tile != NULL && (strcmp(tile->filename, filename) || strcmp(tile->directory, directory)))
+        tile = tile->next;
+    if(tile == NULL){
+        tile = (struct demdTile*)calloc(1, sizeof(struct demdTile));
+        strcpy(tile->directory, directory);
+        strcpy(tile->filename, filename);
+        tile->loading = 1;
+        tile->users = 1;
+        tile->next = tiles;
+        tiles = tile;
+        // read the file outside the lock, other tiles stay available meanwhile
+        pthread_mutex_unlock(&cacheLock);
+        int loaded = loadTile(tile);
+        pthread_mutex_lock(&cacheLock);
+        tile->status = loaded;
+        tile->loading = 0;
+        if(loaded == DEMD_OK){
+            cacheBytes += tileBytes(tile);
+            evictTiles();
+        }
+        pthread_cond_broadcast(&cacheLoaded);
+    }
+    else{
+        tile->users++;
+        while(tile->loading)
+            pthread_cond_wait(&cacheLoaded, &cacheLock);
+    }
+    tile->lastUsed = ++cacheClock;
+    *status = tile->status;
+    pthread_mutex_unlock(&cacheLock);
+    return tile;
+}
+
+static void releaseTile(struct demdTile *tile){
+    pthread_mutex_lock(&cacheLock);
+    tile->users--;
+    // failed loads are forgotten, the file may show up later
+    if(tile->status != DEMD_OK && !tile->users){
+        struct demdTile **t = &tiles;
+        while(*t != tile)
+            t = &(*t)->next;
+        *t = tile->next;
+        free(tile);
+    }
+    else
+        evictTiles();
+    pthread_mutex_unlock(&cacheLock);
+}
+
+// SHARED MEMORY
+//   an anonymous file the size of the result, mapped here to fill it. the client gets the
+//   file descriptor, nothing is left behind in the file system
+static int sharedMemory(unsigned long size, unsigned char **memory){
+#ifdef __linux__
+    int shared = memfd_create("demd", MFD_CLOEXEC);
+#else
+    static unsigned long counter = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/demd.%d.%lu", getpid(), __sync_fetch_and_add(&counter, 1));
+    int shared = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(shared >= 0)
+        shm_unlink(name);
+#endif
+    if(shared < 0)
+        return -1;
+    void *mapping = MAP_FAILED;
+    if(!ftruncate(shared, size))
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shared, 0);
+    if(mapping == MAP_FAILED){
+        close(shared);
+        return -1;
+    }
+    *memory = (unsigned char*)mapping;
+    *(uint64_t*)mapping = size;   // so demdFree knows how much to unmap
+    return shared;
+}
+
+// arrays start on cache lines
+static unsigned long alignOffset(unsigned long offset){
+    return (offset + 63) & ~63ul;
+}
+
+static int16_t* copyRectangle(struct demdTile *tile, unsigned int x, unsigned int y, unsigned int width, unsigned int height, int16_t *crop){
+    for(unsigned int h = 0; h < height; h++)
+        memcpy(&crop[h*width], &tile->data[(unsigned long)(y+h)*tile->meta.ncols + x], sizeof(int16_t)*width);
+    return crop;
+}
+
+static int rectangleInside(struct demMeta meta, unsigned int x, unsigned int y, unsigned int width, unsigned int height){
+    return width && height && x <= meta.ncols && y <= meta.nrows && width <= meta.ncols - x && height <= meta.nrows - y;
+}
+
+static int serveCrop(struct demdTile *tile, struct demdRequest *request, struct demdResponse *response, int *shared){
+    if(!rectangleInside(tile->meta, request->x, request->y, request->width, request->height))
+        return DEMD_ERROR_BOUNDS;
+    unsigned char *memory;
+    response->data = DEMD_HEADER_BYTES;
+    response->size = response->data + sizeof(int16_t) * request->width*request->height;
+    if((*shared = sharedMemory(response->size, &memory)) < 0)
+        return DEMD_ERROR_MEMORY;
+    copyRectangle(tile, request->x, request->y, request->width, request->height, (int16_t*)(memory + response->data));
+    munmap(memory, response->size);
+    response->width = request->width;
+    response->height = request->height;
+    return DEMD_OK;
+}
+
+static int serveSample(struct demdTile *tile, struct demdRequest *request, struct demdResponse *response){
+    unsigned int column, row;
+    getByteColumnRowFromGeoLocation(tile->meta, request->latitude, request->longitude, &column, &row);
+    // the east and south edges round to one past the last sample
+    if(column == tile->meta.ncols) column--;
+    if(row == tile->meta.nrows) row--;
+    if(column >= tile->meta.ncols || row >= tile->meta.nrows)
+        return DEMD_ERROR_BOUNDS;
+    response->elevation = tile->data[(unsigned long)row*tile->meta.ncols + column];
+    return DEMD_OK;
+}
+
+// same arrays as elevationPointCloudWithNormals / elevationTrianglesWithNormals
+static int serveMesh(struct demdTile *tile, struct demdRequest *request, struct demdResponse *response, int *shared){
+    unsigned int width = request->width, height = request->height, column, row;
+    if(!rectangleAroundGeoLocation(tile->meta, request->latitude, request->longitude, &width, &height, &column, &row)
+    || !rectangleInside(tile->meta, column, row, width, height))
+        return DEMD_ERROR_BOUNDS;
+    unsigned long count = (unsigned long)width * height;
+    unsigned long numIndices = (request->op == DEMD_TRIANGLES) ? 6ul*(width-1)*(height-1) : 0;
+
+    response->points = DEMD_HEADER_BYTES;
+    unsigned long offset = alignOffset(response->points + sizeof(float)*count*3);
+    if(request->normals){
+        response->normals = offset;
+        offset = alignOffset(offset + sizeof(float)*count*3);
+    }
+    if(request->op == DEMD_TRIANGLES){
+        response->indices = offset;
+        offset = alignOffset(offset + sizeof(uint32_t)*numIndices);
+    }
+    response->colors = offset;
+    response->size = offset + sizeof(float)*count*3;
+
+    int16_t *data = (int16_t*)malloc(sizeof(int16_t)*count);
+    unsigned char *memory;
+    if(data == NULL || (*shared = sharedMemory(response->size, &memory)) < 0){
+        free(data);
+        return DEMD_ERROR_MEMORY;
+    }
+    copyRectangle(tile, column, row, width, height, data);
+    gridPoints(data, width, height, (float*)(memory + response->points));
+    if(request->normals)
+        elevationNormals(data, width, height, 1.0f, 1.0f, (float*)(memory + response->normals));
+    if(request->op == DEMD_TRIANGLES)
+        response->numIndices = gridTriangleIndices(width, height, (uint32_t*)(memory + response->indices));
+    elevationColors(data, count, (float*)(memory + response->colors));
+    munmap(memory, response->size);
+    free(data);
+
+    response->width = width;
+    response->height = height;
+    response->numPoints = count;
+    return DEMD_OK;
+}
+
+static int serve(struct demdRequest *request, struct demdResponse *response, int *shared){
+    // paths come from another process, make sure they end
+    request->directory[DEMD_PATH_LENGTH-1] = '\0';
+    request->filename[DEMD_PATH_LENGTH-1] = '\0';
+    if(request->op < DEMD_HEADER || request->op > DEMD_TRIANGLES
+    || strlen(request->directory) + strlen(request->filename) + 5 > DEMD_PATH_LENGTH)
+        return DEMD_ERROR_REQUEST;
+
+    int status;
+    struct demdTile *tile = acquireTile(request->directory, request->filename, &status);
+    if(status == DEMD_OK){
+        response->meta = tile->meta;
+        if(request->op == DEMD_CROP)
+            status = serveCrop(tile, request, response, shared);
+        else if(request->op == DEMD_SAMPLE)
+            status = serveSample(tile, request, response);
+        else if(request->op == DEMD_POINT_CLOUD || request->op == DEMD_TRIANGLES)
+            status = serveMesh(tile, request, response, shared);
+    }
+    releaseTile(tile);
+    return status;
+}
+
+static int sendResponse(int connection, struct demdResponse *response, int shared){
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = { response, sizeof(*response) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    if(shared >= 0){
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &shared, sizeof(int));
+    }
+    return sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(*response) ? 0 : -1;
+}
+
+static int receiveRequest(int connection, struct demdRequest *request){
+    unsigned long received = 0;
+    while(received < sizeof(*request)){
+        ssize_t more = recv(connection, (char*)request + received, sizeof(*request) - received, 0);
+        if(more <= 0)
+            return -1;
+        received += more;
+    }
+    return 0;
+}
+
+// one thread per client connection, requests are answered in order
+static void* serveClient(void *context){
+    int connection = (int)(intptr_t)context;
+    struct demdRequest request;
+    while(!receiveRequest(connection, &request)){
+        struct demdResponse response;
+        memset(&response, 0, sizeof(response));
+        int shared = -1;
+        response.status = serve(&request, &response, &shared);
+        if(response.status != DEMD_OK && shared >= 0){
+            close(shared);
+            shared = -1;
+        }
+        int sent = sendResponse(connection, &response, shared);
+        if(shared >= 0)
+            close(shared);
+        if(sent)
+            break;
+    }
+    close(connection);
+    return NULL;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1)
+        cacheLimit = strtoul(argv[1], NULL, 10) << 20;
+    char *path = (argc > 2) ? argv[2] : getenv("DEMD_SOCKET");
+    if(path == NULL)
+        path = DEMD_SOCKET;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        printf("\nEXCEPTION: SOCKET PATH (%s) TOO LONG\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    signal(SIGPIPE, SIG_IGN);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);   // left over from a previous run
+    if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) || listen(listener, 64)){
+        printf("\nEXCEPTION: CAN'T LISTEN ON (%s)\n", path);
+        return 1;
+    }
+    printf("Serving elevation on %s, %lu MB tile cache\n", path, cacheLimit >> 20);
+    fflush(stdout);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for(;;){
+        int connection = accept(listener, NULL, NULL);
+        if(connection < 0)
+            continue;
+        pthread_t thread;
+        if(pthread_create(&thread, &attributes, serveClient, (void*)(intptr_t)connection))
+            close(connection);
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+// load generator for demd: requests per second and latency percentiles
+//   usage: ./demload directory filename [clients] [seconds] [request]
+//     clients: threads, each with its own connection (default 4)
+//     seconds: how long to run (default 5)
+//     request: header, sample, crop, points, triangles or mix (default mix)
+//       mix: 70% samples, 20% crops, 10% triangles
+//   crops and meshes are SIZE x SIZE samples, everything at random places inside the tile
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "demclient.c"
+
+#define SIZE 256
+#define KINDS 5
+#define MIX -1
+
+static const char *kindNames[KINDS] = { "header", "sample", "crop", "points", "triangles" };
+
+struct client {
+	pthread_t thread;
+	unsigned int seed;
+	int kind;                   // one of kindNames, or MIX
+	float *latency[KINDS];      // microseconds, one per request
+	unsigned long count[KINDS];
+	unsigned long capacity[KINDS];
+	unsigned long errors;
+};
+
+static char *directory;
+static char *filename;
+static struct demMeta meta;
+static double deadline;
+
+static double now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void record(struct client *c, int kind, double seconds){
+	if(c->count[kind] == c->capacity[kind]){
+		c->capacity[kind] = c->capacity[kind] ? c->capacity[kind] * 2 : 4096;
+		c->latency[kind] = (float*)realloc(c->latency[kind], sizeof(float) * c->capacity[kind]);
+	}
+	c->latency[kind][c->count[kind]++] = seconds * 1e6;
+}
+
+// a random column, row with room for "margin" samples on every side, as lat/lon of the cell center
+static void randomLocation(struct client *c, unsigned int margin, float *latitude, float *longitude, unsigned int *column, unsigned int *row){
+	*column = margin + rand_r(&c->seed) % (meta.ncols - 2*margin);
+	*row = margin + rand_r(&c->seed) % (meta.nrows - 2*margin);
+	*longitude = meta.ulxmap + (*column + 0.5) * meta.xdim;
+	*latitude = meta.ulymap - (*row + 0.5) * meta.ydim;
+}
+
+static int request(struct client *c, int kind){
+	float latitude, longitude;
+	unsigned int column, row;
+	if(kind == 0)
+		return demdLoadHeader(directory, filename).ncols == meta.ncols;
+	if(kind == 1){
+		randomLocation(c, 0, &latitude, &longitude, &column, &row);
+		demdElevationAt(directory, filename, latitude, longitude);
+		return 1;
+	}
+	if(kind == 2){
+		randomLocation(c, 0, &latitude, &longitude, &column, &row);
+		column = column * (meta.ncols - SIZE) / meta.ncols;
+		row = row * (meta.nrows - SIZE) / meta.nrows;
+		int16_t *crop = demdCropDEM(directory, filename, column, row, SIZE, SIZE);
+		demdFree(crop);
+		return crop != NULL;
+	}
+	float *points = NULL, *colors;
+	uint32_t *indices;
+	unsigned int numPoints, numIndices;
+	randomLocation(c, SIZE/2, &latitude, &longitude, &column, &row);
+	if(kind == 3)
+		demdElevationPointCloud(directory, filename, latitude, longitude, SIZE, SIZE, &points, &colors, &numPoints);
+	else
+		demdElevationTriangles(directory, filename, latitude, longitude, SIZE, SIZE, &points, &indices, &colors, &numPoints, &numIndices);
+	demdFree(points);
+	return points != NULL;
+}
+
+static void* run(void *context){
+	struct client *c = (struct client*)context;
+	while(now() < deadline){
+		int kind = c->kind;
+		if(kind == MIX){
+			int r = rand_r(&c->seed) % 10;
+			kind = (r < 7) ? 1 : (r < 9) ? 2 : 4;
+		}
+		double start = now();
+		int ok = request(c, kind);
+		record(c, kind, now() - start);
+		if(!ok)
+			c->errors++;
+	}
+	demdDisconnect();
+	return NULL;
+}
+
+static int compareFloat(const void *a, const void *b){
+	float x = *(const float*)a, y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+static float percentile(float *sorted, unsigned long count, double p){
+	unsigned long i = p * count;
+	return sorted[i < count ? i : count-1];
+}
+
+static void report(const char *name, float *latency, unsigned long count, double elapsed){
+	if(!count)
+		return;
+	qsort(latency, count, sizeof(float), compareFloat);
+	double sum = 0;
+	for(unsigned long i = 0; i < count; i++)
+		sum += latency[i];
+	printf("%-10s %9lu %10.0f   %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", name, count, count / elapsed, sum / count,
+		percentile(latency, count, .50), percentile(latency, count, .90), percentile(latency, count, .99),
+		percentile(latency, count, .999), latency[count-1]);
+}
+
+int main(int argc, char **argv){
+	if(argc < 3){
+		printf("usage: %s directory filename [clients] [seconds] [header|sample|crop|points|triangles|mix]\n", argv[0]);
+		return 1;
+	}
+	directory = argv[1];
+	filename = argv[2];
+	int clients = (argc > 3) ? atoi(argv[3]) : 4;
+	double seconds = (argc > 4) ? atof(argv[4]) : 5.0;
+	int kind = MIX;
+	if(argc > 5 && strcmp(argv[5], "mix")){
+		for(kind = 0; kind < KINDS && strcmp(argv[5], kindNames[kind]); kind++);
+		if(kind == KINDS){
+			printf("\nEXCEPTION: unknown request (%s)\n", argv[5]);
+			return 1;
+		}
+	}
+	if(clients < 1 || seconds <= 0){
+		printf("\nEXCEPTION: clients and seconds must be positive\n");
+		return 1;
+	}
+
+	// the first request loads the tile, keep it out of the measurement
+	meta = demdLoadHeader(directory, filename);
+	demdDisconnect();
+	if(meta.ncols <= SIZE || meta.nrows <= SIZE){
+		printf("\nEXCEPTION: no tile, or smaller than %d x %d\n", SIZE, SIZE);
+		return 1;
+	}
+
+	struct client *c = (struct client*)calloc(clients, sizeof(struct client));
+	double start = now();
+	deadline = start + seconds;
+	for(int i = 0; i < clients; i++){
+		c[i].seed = i + 1;
+		c[i].kind = kind;
+		pthread_create(&c[i].thread, NULL, run, &c[i]);
+	}
+	for(int i = 0; i < clients; i++)
+		pthread_join(c[i].thread, NULL);
+	double elapsed = now() - start;
+
+	// merge the clients, per request kind and all together
+	unsigned long total = 0, errors = 0;
+	for(int i = 0; i < clients; i++){
+		errors += c[i].errors;
+		for(int k = 0; k < KINDS; k++)
+			total += c[i].count[k];
+	}
+	float *all = (float*)malloc(sizeof(float) * (total ? total : 1));
+	unsigned long allCount = 0;
+	printf("%d clients, %.1f s, %d x %d crops and meshes, %lu errors\n", clients, elapsed, SIZE, SIZE, errors);
+	printf("%-10s %9s %10s   %8s %8s %8s %8s %8s %8s  (microseconds)\n", "request", "count", "per sec", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for(int k = 0; k < KINDS; k++){
+		unsigned long count = 0;
+		for(int i = 0; i < clients; i++)
+			count += c[i].count[k];
+		float *latency = all + allCount;
+		for(int i = 0; i < clients; i++){
+			if(c[i].count[k])
+				memcpy(all + allCount, c[i].latency[k], sizeof(float) * c[i].count[k]);
+			allCount += c[i].count[k];
+			free(c[i].latency[k]);
+		}
+		report(kindNames[k], latency, count, elapsed);
+	}
+	if(kind == MIX)
+		report("all", all, allCount, elapsed);
+	free(all);
+	free(c);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,490 @@
+// headless software renderer for the OpenGL mesh arrays, and a PNG writer
+//   tile-binned, multithreaded rasterization with a depth buffer
+//   include after dem.c (uses parallelRows, demThreadCount)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "render.h"
+
+// 4x4 matrices, column major like OpenGL
+static void matrixIdentity(float *m){
+    for(int i = 0; i < 16; i++)
+        m[i] = (i%5 == 0) ? 1.0f : 0.0f;
+}
+
+// m = m * b, like glMultMatrix
+static void matrixMultiply(float *m, const float *b){
+    float a[16];
+    memcpy(a, m, sizeof(a));
+    for(int col = 0; col < 4; col++)
+        for(int row = 0; row < 4; row++)
+            m[col*4+row] = a[0*4+row]*b[col*4+0] + a[1*4+row]*b[col*4+1] + a[2*4+row]*b[col*4+2] + a[3*4+row]*b[col*4+3];
+}
+
+static void matrixRotate(float *m, float angle, float x, float y, float z){
+    float length = sqrtf(x*x + y*y + z*z);
+    x /= length; y /= length; z /= length;
+    float c = cosf(angle * M_PI / 180.0), s = sinf(angle * M_PI / 180.0), t = 1.0f - c;
+    float r[16] = {
+        x*x*t + c,   y*x*t + z*s, x*z*t - y*s, 0.0f,
+        x*y*t - z*s, y*y*t + c,   y*z*t + x*s, 0.0f,
+        x*z*t + y*s, y*z*t - x*s, z*z*t + c,   0.0f,
+        0.0f,        0.0f,        0.0f,        1.0f
+    };
+    matrixMultiply(m, r);
+}
+
+static void matrixTranslate(float *m, float x, float y, float z){
+    float t[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, x,y,z,1 };
+    matrixMultiply(m, t);
+}
+
+static void matrixScale(float *m, float x, float y, float z){
+    float s[16] = { x,0,0,0, 0,y,0,0, 0,0,z,0, 0,0,0,1 };
+    matrixMultiply(m, s);
+}
+
+static void matrixFrustum(float *m, float left, float right, float bottom, float top, float near, float far){
+    float f[16] = {
+        2*near/(right-left), 0, 0, 0,
+        0, 2*near/(top-bottom), 0, 0,
+        (right+left)/(right-left), (top+bottom)/(top-bottom), -(far+near)/(far-near), -1,
+        0, 0, -2*far*near/(far-near), 0
+    };
+    matrixMultiply(m, f);
+}
+
+// display() in world.c
+static void cameraModelview(struct renderCamera camera, float *m){
+    matrixIdentity(m);
+    matrixRotate(m, camera.rotationY, -1, 0, 0);
+    matrixRotate(m, camera.rotationX, 0, -1, 0);
+    matrixTranslate(m, camera.yPos, 0, -camera.xPos);
+    matrixRotate(m, -90, 1, 0, 0);
+    matrixTranslate(m, 0, 0, -30);
+    matrixScale(m, -1.0f, 1.0f, .10f);
+}
+
+struct renderCamera renderDefaultCamera(){
+    struct renderCamera camera = { 180.0f, 0.0f, 0.0f, 0.0f };
+    return camera;
+}
+
+
+struct renderTarget* renderTargetCreate(unsigned int width, unsigned int height){
+    struct renderTarget *target = (struct renderTarget*)malloc(sizeof(struct renderTarget));
+    target->width = width;
+    target->height = height;
+    target->color = (unsigned char*)malloc(width*height*3);
+    target->depth = (float*)malloc(sizeof(float) * width*height);
+    renderClear(target);
+    return target;
+}
+
+void renderTargetFree(struct renderTarget *target){
+    if(target == NULL)
+        return;
+    free(target->color);
+    free(target->depth);
+    free(target);
+}
+
+void renderClear(struct renderTarget *target){
+    memset(target->color, 0, target->width*target->height*3);
+    for(unsigned int i = 0; i < target->width*target->height; i++)
+        target->depth[i] = 1.0f;
+}
+
+
+// transformed and lit, both sides: GL picks the side per triangle after projection
+struct renderVertex {
+    float clip[4];
+    float front[3];
+    float back[3];
+};
+
+// screen space, ready to rasterize. vertices wind clockwise on screen (positive area)
+struct renderTriangle {
+    float x[3], y[3];       // pixels, y down
+    float z[3];             // depth
+    float w[3];             // 1/w, for perspective correct colors
+    float color[3][3];      // color/w
+    float inverseArea;
+    int minX, minY, maxX, maxY;
+};
+
+// one per setup chunk, so binning needs no locks
+struct renderBins {
+    struct renderTriangle *triangles;
+    unsigned int numTriangles;
+    uint32_t **tiles;       // per tile, indices into triangles
+    unsigned int *tileCount;
+    unsigned int *tileCapacity;
+};
+
+struct renderJob {
+    struct renderTarget *target;
+    float clip[16];
+    float normalMatrix[9];
+    float light[3];
+    float *points;
+    float *normals;
+    float *colors;
+    uint32_t *indices;
+    unsigned int numTriangles;
+    struct renderVertex *vertices;
+    unsigned int tilesX, tilesY;
+    unsigned int numChunks;
+    struct renderBins *bins;
+    volatile unsigned int nextTile;
+};
+
+static void vertexKernel(void *context, unsigned int start, unsigned int end){
+    struct renderJob *job = (struct renderJob*)context;
+    const float *M = job->clip, *N = job->normalMatrix;
+    for(unsigned int i = start; i < end; i++){
+        const float *p = &job->points[i*3];
+        struct renderVertex *v = &job->vertices[i];
+        for(int row = 0; row < 4; row++)
+            v->clip[row] = M[0*4+row]*p[0] + M[1*4+row]*p[1] + M[2*4+row]*p[2] + M[3*4+row];
+        const float *color = &job->colors[i*3];
+        if(job->normals == NULL){
+            memcpy(v->front, color, sizeof(float)*3);
+            memcpy(v->back, color, sizeof(float)*3);
+            continue;
+        }
+        // eye space normal, like GL_NORMALIZE
+        const float *n = &job->normals[i*3];
+        float e[3];
+        for(int row = 0; row < 3; row++)
+            e[row] = N[row*3+0]*n[0] + N[row*3+1]*n[1] + N[row*3+2]*n[2];
+        float length = sqrtf(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+        float diffuse = (length > 0.0f) ? (e[0]*job->light[0] + e[1]*job->light[1] + e[2]*job->light[2]) / length : 0.0f;
+        // global ambient .2 + light ambient .35, plus diffuse, per channel clamped
+        float front = .55f + ((diffuse > 0.0f) ? diffuse : 0.0f);
+        float back = .55f + ((diffuse < 0.0f) ? -diffuse : 0.0f);
+        for(int k = 0; k < 3; k++){
+            v->front[k] = fminf(color[k] * front, 1.0f);
+            v->back[k] = fminf(color[k] * back, 1.0f);
+        }
+    }
+}
+
+static void lerpVertex(const struct renderVertex *a, const struct renderVertex *b, float t, struct renderVertex *out){
+    for(int k = 0; k < 4; k++)
+        out->clip[k] = a->clip[k] + (b->clip[k] - a->clip[k]) * t;
+    for(int k = 0; k < 3; k++){
+        out->front[k] = a->front[k] + (b->front[k] - a->front[k]) * t;
+        out->back[k] = a->back[k] + (b->back[k] - a->back[k]) * t;
+    }
+}
+
+static void binTriangle(struct renderJob *job, struct renderBins *bins, const struct renderVertex *a, const struct renderVertex *b, const struct renderVertex *c){
+    const struct renderVertex *v[3] = { a, b, c };
+    struct renderTarget *target = job->target;
+    struct renderTriangle *t = &bins->triangles[bins->numTriangles];
+    for(int i = 0; i < 3; i++){
+        float w = 1.0f / v[i]->clip[3];
+        t->x[i] = (v[i]->clip[0]*w + 1.0f) * .5f * target->width;
+        t->y[i] = (1.0f - v[i]->clip[1]*w) * .5f * target->height;
+        t->z[i] = (v[i]->clip[2]*w + 1.0f) * .5f;
+        t->w[i] = w;
+    }
+    float area = (t->x[1]-t->x[0])*(t->y[2]-t->y[0]) - (t->y[1]-t->y[0])*(t->x[2]-t->x[0]);
+    if(area == 0.0f || !isfinite(area))
+        return;
+    // counter clockwise with y up (GL's front face) is negative area with y down
+    int front = (area < 0.0f);
+    for(int i = 0; i < 3; i++)
+        for(int k = 0; k < 3; k++)
+            t->color[i][k] = (front ? v[i]->front[k] : v[i]->back[k]) * t->w[i];
+    if(area < 0.0f){
+        // swap 1 and 2 for a positive area
+        float swap;
+        #define SWAP(f) swap = t->f[1]; t->f[1] = t->f[2]; t->f[2] = swap;
+        SWAP(x) SWAP(y) SWAP(z) SWAP(w)
+        #undef SWAP
+        for(int k = 0; k < 3; k++){
+            swap = t->color[1][k]; t->color[1][k] = t->color[2][k]; t->color[2][k] = swap;
+        }
+        area = -area;
+    }
+    t->inverseArea = 1.0f / area;
+    float minX = fminf(t->x[0], fminf(t->x[1], t->x[2])), maxX = fmaxf(t->x[0], fmaxf(t->x[1], t->x[2]));
+    float minY = fminf(t->y[0], fminf(t->y[1], t->y[2])), maxY = fmaxf(t->y[0], fmaxf(t->y[1], t->y[2]));
+    if(maxX < 0.0f || maxY < 0.0f || minX >= target->width || minY >= target->height)
+        return;
+    t->minX = (minX < 0.0f) ? 0 : (int)minX;
+    t->minY = (minY < 0.0f) ? 0 : (int)minY;
+    t->maxX = (maxX >= target->width) ? target->width-1 : (int)maxX;
+    t->maxY = (maxY >= target->height) ? target->height-1 : (int)maxY;
+
+    uint32_t index = bins->numTriangles++;
+    for(int ty = t->minY / RENDER_TILE; ty <= t->maxY / RENDER_TILE; ty++){
+        for(int tx = t->minX / RENDER_TILE; tx <= t->maxX / RENDER_TILE; tx++){
+            unsigned int tile = ty*job->tilesX + tx;
+            if(bins->tileCount[tile] == bins->tileCapacity[tile]){
+                bins->tileCapacity[tile] = bins->tileCapacity[tile] ? bins->tileCapacity[tile]*2 : 64;
+                bins->tiles[tile] = (uint32_t*)realloc(bins->tiles[tile], sizeof(uint32_t) * bins->tileCapacity[tile]);
+            }
+            bins->tiles[tile][bins->tileCount[tile]++] = index;
+        }
+    }
+}
+
+// chunks of triangles: clip against the near plane, project, bin
+static void setupKernel(void *context, unsigned int start, unsigned int end){
+    struct renderJob *job = (struct renderJob*)context;
+    for(unsigned int chunk = start; chunk < end; chunk++){
+        struct renderBins *bins = &job->bins[chunk];
+        unsigned int first = (unsigned int)((uint64_t)job->numTriangles * chunk / job->numChunks);
+        unsigned int last = (unsigned int)((uint64_t)job->numTriangles * (chunk+1) / job->numChunks);
+        // near clipping turns a triangle into at most 2
+        bins->triangles = (struct renderTriangle*)malloc(sizeof(struct renderTriangle) * (2*(last-first) + 1));
+        for(unsigned int t = first; t < last; t++){
+            const struct renderVertex *v[3];
+            float distance[3];
+            int inside = 0;
+            for(int i = 0; i < 3; i++){
+                v[i] = &job->vertices[job->indices[t*3+i]];
+                distance[i] = v[i]->clip[2] + v[i]->clip[3];   // >= 0 in front of the near plane
+                if(distance[i] >= 0.0f) inside++;
+            }
+            if(inside == 3){
+                binTriangle(job, bins, v[0], v[1], v[2]);
+                continue;
+            }
+            if(inside == 0)
+                continue;
+            struct renderVertex polygon[4];
+            int count = 0;
+            for(int i = 0; i < 3; i++){
+                int j = (i+1) % 3;
+                if(distance[i] >= 0.0f)
+                    polygon[count++] = *v[i];
+                if((distance[i] >= 0.0f) != (distance[j] >= 0.0f))
+                    lerpVertex(v[i], v[j], distance[i] / (distance[i] - distance[j]), &polygon[count++]);
+            }
+            for(int i = 2; i < count; i++)
+                binTriangle(job, bins, &polygon[0], &polygon[i-1], &polygon[i]);
+        }
+    }
+}
+
+static void rasterTile(struct renderJob *job, unsigned int tile){
+    struct renderTarget *target = job->target;
+    int tileX0 = (tile % job->tilesX) * RENDER_TILE, tileY0 = (tile / job->tilesX) * RENDER_TILE;
+    int tileX1 = tileX0 + RENDER_TILE - 1, tileY1 = tileY0 + RENDER_TILE - 1;
+    // submission order: chunks are consecutive ranges of the index buffer
+    for(unsigned int chunk = 0; chunk < job->numChunks; chunk++){
+        struct renderBins *bins = &job->bins[chunk];
+        for(unsigned int b = 0; b < bins->tileCount[tile]; b++){
+            const struct renderTriangle *t = &bins->triangles[bins->tiles[tile][b]];
+            int x0 = (t->minX > tileX0) ? t->minX : tileX0, x1 = (t->maxX < tileX1) ? t->maxX : tileX1;
+            int y0 = (t->minY > tileY0) ? t->minY : tileY0, y1 = (t->maxY < tileY1) ? t->maxY : tileY1;
+            // edge functions at the first pixel center and their steps
+            float px = x0 + .5f, py = y0 + .5f;
+            float e0 = (t->x[2]-t->x[1])*(py-t->y[1]) - (t->y[2]-t->y[1])*(px-t->x[1]);
+            float e1 = (t->x[0]-t->x[2])*(py-t->y[2]) - (t->y[0]-t->y[2])*(px-t->x[2]);
+            float e2 = (t->x[1]-t->x[0])*(py-t->y[0]) - (t->y[1]-t->y[0])*(px-t->x[0]);
+            float dx0 = -(t->y[2]-t->y[1]), dx1 = -(t->y[0]-t->y[2]), dx2 = -(t->y[1]-t->y[0]);
+            float dy0 = t->x[2]-t->x[1], dy1 = t->x[0]-t->x[2], dy2 = t->x[1]-t->x[0];
+            for(int y = y0; y <= y1; y++){
+                float a = e0, b = e1, c = e2;
+                for(int x = x0; x <= x1; x++){
+                    if(a >= 0.0f && b >= 0.0f && c >= 0.0f){
+                        float l0 = a * t->inverseArea, l1 = b * t->inverseArea, l2 = c * t->inverseArea;
+                        float z = l0*t->z[0] + l1*t->z[1] + l2*t->z[2];
+                        unsigned int pixel = y*target->width + x;
+                        if(z < target->depth[pixel] && z >= 0.0f){
+                            target->depth[pixel] = z;
+                            float w = 1.0f / (l0*t->w[0] + l1*t->w[1] + l2*t->w[2]);
+                            for(int k = 0; k < 3; k++){
+                                float value = (l0*t->color[0][k] + l1*t->color[1][k] + l2*t->color[2][k]) * w;
+                                if(value < 0.0f) value = 0.0f;
+                                if(value > 1.0f) value = 1.0f;
+                                target->color[pixel*3+k] = (unsigned char)(value * 255.0f + .5f);
+                            }
+                        }
+                    }
+                    a += dx0; b += dx1; c += dx2;
+                }
+                e0 += dy0; e1 += dy1; e2 += dy2;
+            }
+        }
+    }
+}
+
+// tiles are handed out from a shared counter, so each band just pulls until none are left
+static void rasterKernel(void *context, unsigned int start, unsigned int end){
+    struct renderJob *job = (struct renderJob*)context;
+    unsigned int numTiles = job->tilesX * job->tilesY;
+    for(;;){
+        unsigned int tile = __sync_fetch_and_add(&job->nextTile, 1);
+        if(tile >= numTiles)
+            break;
+        rasterTile(job, tile);
+    }
+}
+
+void renderTriangles(struct renderTarget *target, struct renderCamera camera, float *points, float *normals, float *colors, uint32_t *indices, unsigned int numPoints, unsigned int numIndices){
+    if(!numPoints || numIndices < 3)
+        return;
+    struct renderJob job;
+    job.target = target;
+    job.points = points;
+    job.normals = normals;
+    job.colors = colors;
+    job.indices = indices;
+    job.numTriangles = numIndices / 3;
+
+    // reshape(): the frustum keeps the window's aspect
+    float modelview[16];
+    float aspect = (float)target->width / target->height;
+    cameraModelview(camera, modelview);
+    matrixIdentity(job.clip);
+    matrixFrustum(job.clip, -1.0f, 1.0f, -1.0f/aspect, 1.0f/aspect, RENDER_NEAR, RENDER_FAR);
+    matrixMultiply(job.clip, modelview);
+
+    // normals transform by the inverse transpose (cofactors over the determinant)
+    const float *m = modelview;
+    float *N = job.normalMatrix;
+    N[0] = m[5]*m[10] - m[6]*m[9];  N[1] = m[2]*m[9] - m[1]*m[10];  N[2] = m[1]*m[6] - m[2]*m[5];
+    N[3] = m[6]*m[8] - m[4]*m[10];  N[4] = m[0]*m[10] - m[2]*m[8];  N[5] = m[2]*m[4] - m[0]*m[6];
+    N[6] = m[4]*m[9] - m[5]*m[8];   N[7] = m[1]*m[8] - m[0]*m[9];   N[8] = m[0]*m[5] - m[1]*m[4];
+    float determinant = m[0]*N[0] + m[4]*N[1] + m[8]*N[2];
+    for(int i = 0; i < 9; i++)
+        N[i] /= determinant;
+    float lightLength = sqrtf(3.0f);
+    job.light[0] = -1.0f / lightLength;
+    job.light[1] = -1.0f / lightLength;
+    job.light[2] = 1.0f / lightLength;
+
+    job.vertices = (struct renderVertex*)malloc(sizeof(struct renderVertex) * numPoints);
+    parallelRows(numPoints, 4096, vertexKernel, &job);
+
+    job.tilesX = (target->width + RENDER_TILE-1) / RENDER_TILE;
+    job.tilesY = (target->height + RENDER_TILE-1) / RENDER_TILE;
+    unsigned int numTiles = job.tilesX * job.tilesY;
+    job.numChunks = demThreadCount();
+    job.bins = (struct renderBins*)calloc(job.numChunks, sizeof(struct renderBins));
+    for(unsigned int c = 0; c < job.numChunks; c++){
+        job.bins[c].tiles = (uint32_t**)calloc(numTiles, sizeof(uint32_t*));
+        job.bins[c].tileCount = (unsigned int*)calloc(numTiles, sizeof(unsigned int));
+        job.bins[c].tileCapacity = (unsigned int*)calloc(numTiles, sizeof(unsigned int));
+    }
+    parallelRows(job.numChunks, 1, setupKernel, &job);
+
+    job.nextTile = 0;
+    parallelRows(job.numChunks, 1, rasterKernel, &job);
+
+    for(unsigned int c = 0; c < job.numChunks; c++){
+        for(unsigned int t = 0; t < numTiles; t++)
+            free(job.bins[c].tiles[t]);
+        free(job.bins[c].tiles);
+        free(job.bins[c].tileCount);
+        free(job.bins[c].tileCapacity);
+        free(job.bins[c].triangles);
+    }
+    free(job.bins);
+    free(job.vertices);
+}
+
+
+// PNG
+static uint32_t crcTable[256];
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t length){
+    if(!crcTable[1]){
+        for(uint32_t n = 0; n < 256; n++){
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+    }
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void writeBigEndian(unsigned char *out, uint32_t value){
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void writeChunk(FILE *file, const char *type, const unsigned char *data, uint32_t length){
+    unsigned char header[8];
+    writeBigEndian(header, length);
+    memcpy(&header[4], type, 4);
+    fwrite(header, 1, 8, file);
+    if(length)
+        fwrite(data, 1, length, file);
+    uint32_t crc = crc32(crc32(0, (const unsigned char*)type, 4), data, length);
+    unsigned char footer[4];
+    writeBigEndian(footer, crc);
+    fwrite(footer, 1, 4, file);
+}
+
+int writePNG(char *path, unsigned char *rgb, unsigned int width, unsigned int height){
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        printf("\nEXCEPTION: CAN'T WRITE FILE (%s)\n", path);
+        return -1;
+    }
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    fwrite(signature, 1, 8, file);
+
+    unsigned char header[13];
+    writeBigEndian(&header[0], width);
+    writeBigEndian(&header[4], height);
+    header[8] = 8;      // bits per channel
+    header[9] = 2;      // RGB
+    header[10] = 0;     // deflate
+    header[11] = 0;     // adaptive filtering
+    header[12] = 0;     // no interlace
+    writeChunk(file, "IHDR", header, 13);
+
+    // zlib stream of stored blocks, each scanline starts with filter type 0
+    size_t rowBytes = (size_t)width*3 + 1;
+    size_t raw = rowBytes * height;
+    size_t numBlocks = (raw + 65534) / 65535;
+    if(!numBlocks) numBlocks = 1;
+    size_t length = 2 + raw + numBlocks*5 + 4;
+    unsigned char *data = (unsigned char*)malloc(length);
+    unsigned char *out = data;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    uint32_t a = 1, b = 0;      // adler32
+    size_t position = 0;
+    for(size_t block = 0; block < numBlocks; block++){
+        size_t size = raw - position;
+        if(size > 65535) size = 65535;
+        *out++ = (block == numBlocks-1) ? 1 : 0;
+        *out++ = size & 0xFF;
+        *out++ = size >> 8;
+        *out++ = ~size & 0xFF;
+        *out++ = (~size >> 8) & 0xFF;
+        for(size_t i = 0; i < size; i++, position++){
+            size_t column = position % rowBytes;
+            unsigned char byte = column ? rgb[(position / rowBytes)*width*3 + column-1] : 0;
+            *out++ = byte;
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    writeBigEndian(out, (b << 16) | a);
+    writeChunk(file, "IDAT", data, length);
+    writeChunk(file, "IEND", NULL, 0);
+    free(data);
+    fclose(file);
+    return 0;
+}
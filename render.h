@@ -0,0 +1,58 @@
+#ifndef GISOSX_RENDER_h
+#define GISOSX_RENDER_h
+
+
+// SOFTWARE RENDERER
+// --------------------------------------------------
+// draws the OpenGL arrays from the mesh builders (points, normals, colors, indices)
+// without a window or GPU, into an RGB framebuffer with a depth buffer.
+//
+// CAMERA
+//    same math as display() and reshape() in world.c:
+//    glFrustum(-1, 1, -1/aspect, 1/aspect, 1.5, 2000), then the mouse rotations,
+//    the walk offset, and the mesh lying 30 units below the eye with z scaled by .1
+//
+// LIGHTING
+//    same as world.c: one white directional light from (-1, -1, 1) in eye space,
+//    ambient .35 plus the default global ambient .2, two-sided, per-vertex.
+//    pass normals as NULL for flat colors
+//
+// THREADING
+//    the screen is split into RENDER_TILE x RENDER_TILE pixel tiles. triangles are set up and
+//    binned into the tiles they touch in parallel, then tiles are rasterized in parallel
+
+#define RENDER_TILE 64
+#define RENDER_NEAR 1.5f
+#define RENDER_FAR 2000.0f
+
+struct renderCamera {
+    float rotationX;    // world.c mouseRotationX, degrees
+    float rotationY;    // world.c mouseRotationY, degrees
+    float xPos;         // world.c xPos, walking forward
+    float yPos;         // world.c yPos, walking sideways
+};
+
+struct renderTarget {
+    unsigned int width;
+    unsigned int height;
+    unsigned char *color;   // RGB, width * height * 3, top row first
+    float *depth;           // width * height, 0 (near) to 1 (far)
+};
+
+// world.c's starting view
+struct renderCamera renderDefaultCamera();
+
+struct renderTarget* renderTargetCreate(unsigned int width, unsigned int height);
+void renderTargetFree(struct renderTarget *target);
+// clear to black, depth to far
+void renderClear(struct renderTarget *target);
+
+// GL_TRIANGLES, same arrays as glVertexPointer, glNormalPointer, glColorPointer, glDrawElements
+void renderTriangles(struct renderTarget *target, struct renderCamera camera, float *points, float *normals, float *colors, uint32_t *indices, unsigned int numPoints, unsigned int numIndices);
+
+// PNG OUTPUT
+//   8 bit RGB, uncompressed (stored) deflate blocks so there is no zlib dependency
+//   returns 0 on success
+int writePNG(char *path, unsigned char *rgb, unsigned int width, unsigned int height);
+
+#endif
@@ -0,0 +1,67 @@
+// renders the same view as world.c to a PNG, no window or GPU needed
+//   usage: ./thumbnail directory filename latitude longitude output.png [width height] [tilt] [frames]
+//     width, height: image size (default 800 x 400, the world.c window)
+//     tilt: world.c mouseRotationY, degrees (default 0, the starting view)
+//     frames: render this many times and report frames per second (default 1)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dem.c"
+#include "render.c"
+
+// mesh size, same as world.c
+static int height = 400;
+static int width = 800;
+
+static double now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv){
+	if(argc < 6){
+		printf("usage: %s directory filename latitude longitude output.png [width height] [tilt] [frames]\n", argv[0]);
+		return 1;
+	}
+	unsigned int imageWidth = (argc > 7) ? atoi(argv[6]) : 800;
+	unsigned int imageHeight = (argc > 7) ? atoi(argv[7]) : 400;
+	float tilt = (argc > 8) ? atof(argv[8]) : 0.0f;
+	int frames = (argc > 9) ? atoi(argv[9]) : 1;
+	if(!imageWidth || !imageHeight || frames < 1){
+		printf("\nEXCEPTION: image size and frames must be positive\n");
+		return 1;
+	}
+
+	float *points, *normals, *colors;
+	uint32_t *indices;
+	unsigned int numPoints = 0, numIndices = 0, numCulled;
+	elevationTrianglesCulled(argv[1], argv[2], atof(argv[3]), atof(argv[4]), width, height, DEM_OCEAN_PLANE, &points, &normals, &indices, &colors, &numPoints, &numIndices, &numCulled);
+	if(!numPoints){
+		printf("\nEXCEPTION: no mesh to render\n");
+		return 1;
+	}
+	optimizeVertexCache(indices, numIndices, numPoints, 16);
+
+	struct renderTarget *target = renderTargetCreate(imageWidth, imageHeight);
+	struct renderCamera camera = renderDefaultCamera();
+	camera.rotationY = tilt;
+	double start = now();
+	for(int i = 0; i < frames; i++){
+		renderClear(target);
+		renderTriangles(target, camera, points, normals, colors, indices, numPoints, numIndices);
+	}
+	double elapsed = now() - start;
+	printf("%u triangles, %u x %u, %d frames in %.3f s: %.1f frames per second (%u threads)\n",
+		numIndices/3, imageWidth, imageHeight, frames, elapsed, frames / elapsed, demThreadCount());
+
+	int result = writePNG(argv[5], target->color, imageWidth, imageHeight);
+	renderTargetFree(target);
+	free(points);
+	free(normals);
+	free(colors);
+	free(indices);
+	return result ? 1 : 0;
+}
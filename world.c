@@ -15,10 +15,12 @@
 
 static GLfloat spin = 0.0f;
 static float *_points;
+static float *_normals;
 static uint32_t *_indices;
 static float *_colors;
 static unsigned int _numPoints;
 static unsigned int _numIndices;
+static unsigned int _numCulled;
 
 static int height = 400;
 static int width = 800;
@@ -49,7 +51,18 @@ static float *political;
 
 void init(){
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glShadeModel(GL_FLAT);
+	glShadeModel(GL_SMOOTH);
+
+	// one directional light, colors from the elevation ramp
+	GLfloat lightPosition[] = { -1.0f, -1.0f, 1.0f, 0.0f };
+	GLfloat lightAmbient[] = { 0.35f, 0.35f, 0.35f, 1.0f };
+	glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+	glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_COLOR_MATERIAL);
+	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+	glEnable(GL_NORMALIZE);   // glScalef below squashes z
 
 	char directory[] = "/Users/Robby/Code/DEM/w100n90/";
     char filename[] = "W100N90";
@@ -63,7 +76,8 @@ void init(){
 
 
     // elevationPointCloud(directory, filename, 41.3110871, -72.8074902, width, height, &_points, &_colors, &_numPoints);
-	elevationTriangles(directory, filename, 41.3110871, -72.8074902, width, height, &_points, &_indices, &_colors, &_numPoints, &_numIndices);
+	elevationTrianglesCulled(directory, filename, 41.3110871, -72.8074902, width, height, DEM_OCEAN_PLANE, &_points, &_normals, &_indices, &_colors, &_numPoints, &_numIndices, &_numCulled);
+	optimizeVertexCache(_indices, _numIndices, _numPoints, 16);
 	// elevationTriangles(directory, filename, 37.7953325,-122.1066646, width, height, &_points, &_indices, &_colors, &_numPoints, &_numIndices);
 
     // elevationPointCloud(directory, filename, 44.0, -120.5, width, height, &_points, &_colors, &_numPoints);
@@ -107,15 +121,20 @@ void display(){
 		// glRotatef(sin(spin*.004)*90, 0.0f, 0.0f, 1.0f);  // PERSPECTIVE 2
 		glPushMatrix();
 		glScalef(-1.0f, 1.0f, .10f);
+		glEnable(GL_LIGHTING);
 		glEnableClientState(GL_COLOR_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glColor3f(0.5f, 1.0f, 0.5f);
 		glColorPointer(3, GL_FLOAT, 0, _colors);
+		glNormalPointer(GL_FLOAT, 0, _normals);
 		glVertexPointer(3, GL_FLOAT, 0, _points);
 		// glDrawArrays(GL_POINTS, 0, _numPoints);
 		glDrawElements(GL_TRIANGLES, _numIndices, GL_UNSIGNED_INT, _indices);
 		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_NORMAL_ARRAY);
 		glDisableClientState(GL_COLOR_ARRAY);
+		glDisable(GL_LIGHTING);
 		glPopMatrix();
 
 		// glPushMatrix();